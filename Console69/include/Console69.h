@@ -6,6 +6,9 @@
 #define WIN32_LEAN_AND_MEAN
 
 #include <Windows.h>
+#include <emmintrin.h>
+
+#include "VectorMath.h"
 
 #include <iostream>
 #include <chrono>
@@ -14,6 +17,9 @@
 #include <thread>
 #include <atomic>
 #include <condition_variable>
+#include <mutex>
+#include <type_traits>
+#include <cstdint>
 
 enum PixelType
 {
@@ -187,6 +193,411 @@ public:
 	}
 };
 
+// bump allocator for data that only lives for one frame, the engine resets it
+// right before every OnUpdate. A frame that outgrows the block spills into
+// extra ones, and the next reset folds them into a single block big enough
+// for all of it, so once the high water mark settles the heap is left alone.
+// Only meant for the game thread
+class FrameArena
+{
+public:
+	explicit FrameArena(size_t initialSize = 64 * 1024)
+		:
+		initialSize{ initialSize }
+	{}
+
+	~FrameArena()
+	{
+		for (auto& b : blocks)
+			delete[] b.data;
+	}
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	void* Allocate(size_t bytes, size_t align)
+	{
+		if (blocks.empty())
+			blocks.push_back({ new char[initialSize], initialSize });
+
+		Block& block = blocks.back();
+		uintptr_t begin = (uintptr_t)block.data;
+		uintptr_t p = (begin + offset + align - 1) & ~(uintptr_t)(align - 1);
+		if (p + bytes > begin + block.size)
+		{
+			size_t size = max(block.size, bytes + align);
+			blocks.push_back({ new char[size], size });
+			offset = 0;
+			return Allocate(bytes, align);
+		}
+
+		offset = p + bytes - begin;
+		used += bytes;
+		if (used > highWater)
+			highWater = used;
+		return (void*)p;
+	}
+
+	void Reset()
+	{
+		if (blocks.size() > 1)
+		{
+			size_t total = 0;
+			for (auto& b : blocks)
+			{
+				total += b.size;
+				delete[] b.data;
+			}
+			blocks.clear();
+			blocks.push_back({ new char[total], total });
+		}
+
+		offset = 0;
+		used = 0;
+	}
+
+	size_t GetUsed() const { return used; }
+	size_t GetHighWaterMark() const { return highWater; }
+
+	size_t GetCapacity() const
+	{
+		size_t total = 0;
+		for (auto& b : blocks)
+			total += b.size;
+		return total;
+	}
+
+private:
+	struct Block
+	{
+		char* data;
+		size_t size;
+	};
+
+	std::vector<Block> blocks;
+	size_t initialSize;
+	size_t offset = 0;
+	size_t used = 0;
+	size_t highWater = 0;
+};
+
+// lets STL containers live in a FrameArena, deallocate is a no-op since the
+// whole arena goes at once. Containers must not outlive the frame
+template<typename T>
+class ArenaAllocator
+{
+public:
+	using value_type = T;
+
+	ArenaAllocator(FrameArena& arena) noexcept
+		:
+		arena{ &arena }
+	{}
+
+	template<typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+		:
+		arena{ other.arena }
+	{}
+
+	T* allocate(size_t n)
+	{
+		return (T*)arena->Allocate(n * sizeof(T), alignof(T));
+	}
+
+	void deallocate(T*, size_t) noexcept {}
+
+	template<typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+	template<typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+
+	FrameArena* arena;
+};
+
+template<typename T>
+using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+// a handful of threads that chew through numbered jobs, the calling thread
+// pitches in and only returns once every job is done. Threads are spawned on
+// first use so apps that never go parallel don't pay for them
+class WorkerPool
+{
+public:
+	WorkerPool() = default;
+
+	~WorkerPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mux);
+			quit = true;
+		}
+		wake.notify_all();
+		for (auto& t : threads)
+			t.join();
+	}
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	// including the calling thread
+	int GetWorkerCount()
+	{
+		Spawn();
+		return (int)threads.size() + 1;
+	}
+
+	// runs job(i) for every i in [0, count), in no particular order
+	template<typename Job>
+	void ParallelFor(int count, Job&& job)
+	{
+		if (count <= 0)
+			return;
+
+		if (count == 1)
+		{
+			job(0);
+			return;
+		}
+
+		Spawn();
+
+		{
+			std::lock_guard<std::mutex> lock(mux);
+			context = &job;
+			invoke = [](void* c, int i) { (*(typename std::remove_reference<Job>::type*)c)(i); };
+			jobCount = count;
+			nextJob = 0;
+			++generation;
+		}
+		wake.notify_all();
+
+		RunJobs(invoke, context, count);
+
+		// workers that picked up this batch must be out before the job dies
+		std::unique_lock<std::mutex> lock(mux);
+		done.wait(lock, [&] { return active == 0; });
+		invoke = nullptr;
+		context = nullptr;
+	}
+
+private:
+	void Spawn()
+	{
+		if (spawned)
+			return;
+		spawned = true;
+
+		int count = (int)std::thread::hardware_concurrency() - 1;
+		for (int i = 0; i < count; ++i)
+			threads.emplace_back(&WorkerPool::WorkerThread, this);
+	}
+
+	void RunJobs(void (*fn)(void*, int), void* c, int count)
+	{
+		for (int i = nextJob++; i < count; i = nextJob++)
+			fn(c, i);
+	}
+
+	void WorkerThread()
+	{
+		unsigned seen = 0;
+		std::unique_lock<std::mutex> lock(mux);
+		while (true)
+		{
+			wake.wait(lock, [&] { return quit || generation != seen; });
+			if (quit)
+				return;
+
+			// late wake up for a batch that's already been wrapped up
+			seen = generation;
+			if (invoke == nullptr)
+				continue;
+
+			auto fn = invoke;
+			void* c = context;
+			int count = jobCount;
+			++active;
+
+			lock.unlock();
+			RunJobs(fn, c, count);
+			lock.lock();
+
+			if (--active == 0)
+				done.notify_all();
+		}
+	}
+
+	std::vector<std::thread> threads;
+	bool spawned = false;
+
+	std::mutex mux;
+	std::condition_variable wake;
+	std::condition_variable done;
+	bool quit = false;
+	unsigned generation = 0;
+	int active = 0;
+
+	void (*invoke)(void*, int) = nullptr;
+	void* context = nullptr;
+	int jobCount = 0;
+	std::atomic<int> nextJob{ 0 };
+};
+
+// short lived points for sparks, smoke and debris. Kept as parallel arrays
+// that only ever grow, count is how many are live, so moving them is a
+// straight SSE walk and a dead particle is swapped out with the last one.
+// Emitting draws from its own random stream so effects don't disturb a
+// game's rand(). Drawn with Console69::DrawParticles
+class ParticleSystem
+{
+public:
+	void Reserve(int capacity)
+	{
+		if (capacity <= (int)x.size())
+			return;
+
+		x.resize(capacity);
+		y.resize(capacity);
+		xv.resize(capacity);
+		yv.resize(capacity);
+		life.resize(capacity);
+		fade.resize(capacity);
+		col.resize(capacity);
+	}
+
+	void Clear()
+	{
+		count = 0;
+	}
+
+	// n particles from (px, py) carrying (vx, vy), thrown at up to speed in
+	// directions within spread radians around heading, 0 being +x. Each gets
+	// a random share of speed and of lifetime seconds
+	void Emit(int n, float px, float py, float vx, float vy,
+		float heading, float spread, float speed, float lifetime, short c)
+	{
+		if (n <= 0 || lifetime <= 0.0f)
+			return;
+
+		if (count + n > (int)x.size())
+			Reserve(max(count + n, max(256, count * 2)));
+
+		for (int i = count; i < count + n; ++i)
+		{
+			float angle = heading + (Random() - 0.5f) * spread;
+			float s = speed * (0.25f + 0.75f * Random());
+			float l = lifetime * (0.5f + 0.5f * Random());
+			x[i] = px;
+			y[i] = py;
+			xv[i] = vx + s * cosf(angle);
+			yv[i] = vy + s * sinf(angle);
+			life[i] = l;
+			fade[i] = 1.0f / l;
+			col[i] = c;
+		}
+		count += n;
+	}
+
+	// moves everything and ages it, whatever runs out of life goes
+	void Integrate(float deltaTime)
+	{
+		const __m128 step = _mm_set1_ps(deltaTime);
+		const __m128 zero = _mm_setzero_ps();
+		int died = 0;
+		int i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			_mm_storeu_ps(&x[i], _mm_add_ps(_mm_loadu_ps(&x[i]), _mm_mul_ps(_mm_loadu_ps(&xv[i]), step)));
+			_mm_storeu_ps(&y[i], _mm_add_ps(_mm_loadu_ps(&y[i]), _mm_mul_ps(_mm_loadu_ps(&yv[i]), step)));
+			__m128 l = _mm_sub_ps(_mm_loadu_ps(&life[i]), step);
+			_mm_storeu_ps(&life[i], l);
+			died |= _mm_movemask_ps(_mm_cmple_ps(l, zero));
+		}
+		for (; i < count; ++i)
+		{
+			x[i] += xv[i] * deltaTime;
+			y[i] += yv[i] * deltaTime;
+			life[i] -= deltaTime;
+			died |= life[i] <= 0.0f;
+		}
+
+		// most frames nothing expires and this pass is skipped
+		if (died == 0)
+			return;
+
+		for (i = 0; i < count;)
+		{
+			if (life[i] <= 0.0f)
+				Remove(i);
+			else
+				++i;
+		}
+	}
+
+	// for fields that wrap round the screen edges, one field width at most
+	void Wrap(float width, float height)
+	{
+		const __m128 w = _mm_set1_ps(width);
+		const __m128 h = _mm_set1_ps(height);
+		const __m128 zero = _mm_setzero_ps();
+		int i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 px = _mm_loadu_ps(&x[i]);
+			__m128 py = _mm_loadu_ps(&y[i]);
+			px = _mm_sub_ps(_mm_add_ps(px, _mm_and_ps(_mm_cmplt_ps(px, zero), w)), _mm_and_ps(_mm_cmpge_ps(px, w), w));
+			py = _mm_sub_ps(_mm_add_ps(py, _mm_and_ps(_mm_cmplt_ps(py, zero), h)), _mm_and_ps(_mm_cmpge_ps(py, h), h));
+			_mm_storeu_ps(&x[i], px);
+			_mm_storeu_ps(&y[i], py);
+		}
+		for (; i < count; ++i)
+		{
+			if (x[i] < 0.0f)		x[i] += width;
+			else if (x[i] >= width)	x[i] -= width;
+			if (y[i] < 0.0f)		y[i] += height;
+			else if (y[i] >= height)	y[i] -= height;
+		}
+	}
+
+	int GetCount() const { return count; }
+
+private:
+	void Remove(int i)
+	{
+		--count;
+		x[i] = x[count];
+		y[i] = y[count];
+		xv[i] = xv[count];
+		yv[i] = yv[count];
+		life[i] = life[count];
+		fade[i] = fade[count];
+		col[i] = col[count];
+	}
+
+	// xorshift, [0, 1)
+	float Random()
+	{
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		return (float)(seed >> 8) * (1.0f / 16777216.0f);
+	}
+
+	unsigned seed = 0x2545F491;
+
+public:
+	// life is seconds left, fade is one over the life it started with
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> xv;
+	std::vector<float> yv;
+	std::vector<float> life;
+	std::vector<float> fade;
+	std::vector<short> col;
+	int count{};
+};
+
 class Console69
 {
 public:
@@ -330,6 +741,59 @@ public:
 	}
 
 	void DrawLine(int x1, int y1, int x2, int y2, short cha = 0x2588, short col = 0x000F)
+	{
+		WalkLine(x1, y1, x2, y2, [&](int x, int y) { Draw(x, y, cha, col); });
+	}
+
+	// the line on a field that wraps at the screen edges, for endpoints up to
+	// a screen outside it. Rather than wrapping every cell, each copy of the
+	// line one screen over that touches the screen is drawn as it is, one to
+	// four of them. Copies completely on screen skip the bounds test, and
+	// none of it goes through the virtual Draw
+	void DrawLineWrapped(int x1, int y1, int x2, int y2, short cha = 0x2588, short col = 0x000F)
+	{
+		const int minX = min(x1, x2), maxX = max(x1, x2);
+		const int minY = min(y1, y2), maxY = max(y1, y2);
+
+		for (int oy = -screenHeight; oy <= screenHeight; oy += screenHeight)
+		{
+			if (maxY + oy < 0 || minY + oy >= screenHeight)
+				continue;
+
+			for (int ox = -screenWidth; ox <= screenWidth; ox += screenWidth)
+			{
+				if (maxX + ox < 0 || minX + ox >= screenWidth)
+					continue;
+
+				CHAR_INFO* buffer = screenBuffer;
+				const int width = screenWidth;
+				const int height = screenHeight;
+				if (minX + ox >= 0 && maxX + ox < width && minY + oy >= 0 && maxY + oy < height)
+				{
+					WalkLine(x1 + ox, y1 + oy, x2 + ox, y2 + oy, [=](int x, int y)
+						{
+							buffer[x + y * width].Char.UnicodeChar = cha;
+							buffer[x + y * width].Attributes = col;
+						});
+				}
+				else
+				{
+					WalkLine(x1 + ox, y1 + oy, x2 + ox, y2 + oy, [=](int x, int y)
+						{
+							if ((unsigned)x < (unsigned)width && (unsigned)y < (unsigned)height)
+							{
+								buffer[x + y * width].Char.UnicodeChar = cha;
+								buffer[x + y * width].Attributes = col;
+							}
+						});
+				}
+			}
+		}
+	}
+
+	// Bresenham from (x1, y1) to (x2, y2), plot(x, y) for every cell on it
+	template<typename Plot>
+	void WalkLine(int x1, int y1, int x2, int y2, Plot&& plot)
 	{
 		int x{}, y{}, dx{}, dy{}, dx1{}, dy1{}, px{}, py{}, xe{}, ye{};
 		int i{};
@@ -354,7 +818,7 @@ public:
 				xe = x1;
 			}
 
-			Draw(x, y, cha, col);
+			plot(x, y);
 
 			for (int i = 0; x < xe; ++i)
 			{
@@ -371,7 +835,7 @@ public:
 						y -= 1;
 					px += 2 * (dy1 - dx1);
 				}
-				Draw(x, y, cha, col);
+				plot(x, y);
 			}
 		}
 		else
@@ -388,7 +852,7 @@ public:
 				y = y2;
 				ye = y1;
 			}
-			Draw(x, y, cha, col);
+			plot(x, y);
 
 			for (i = 0; y < ye; ++i)
 			{
@@ -405,7 +869,7 @@ public:
 						x -= 1;
 					py += 2 * (dx1 - dy1);
 				}
-				Draw(x, y, cha, col);
+				plot(x, y);
 			}
 		}
 	}
@@ -421,7 +885,18 @@ public:
 	void FillTriangle(int x1, int y1, int x2, int y2, int x3, int y3, short cha = 0x2588, short col = 0x000F)
 	{
 		auto SWAP = [](int& x, int& y) { int t = x; x = y; y = t; };
-		auto drawline = [&](int sx, int ex, int ny) { for (int i = sx; i <= ex; i++) Draw(i, ny, cha, col); };
+		auto drawline = [&](int sx, int ex, int ny)
+		{
+			// clip the whole span once rather than every cell
+			if (ny < 0 || ny >= screenHeight)
+				return;
+			if (sx < 0)
+				sx = 0;
+			if (ex >= screenWidth)
+				ex = screenWidth - 1;
+			for (int i = sx; i <= ex; i++)
+				Draw(i, ny, cha, col);
+		};
 
 		int t1x, t2x, y, minx, maxx, t1xp, t2xp;
 		bool changed1 = false;
@@ -555,6 +1030,177 @@ public:
 		}
 	}
 
+	// edge function rasterizer, same job as FillTriangle but with a consistent
+	// top-left fill rule so triangles sharing an edge never overlap or leave a
+	// gap. Writes straight into the screen buffer, it does not go through Draw
+	void FillTriangleHalfSpace(int x1, int y1, int x2, int y2, int x3, int y3, short cha = 0x2588, short col = 0x000F)
+	{
+		const int one = 1 << SubpixelBits;
+		FillTriangleSubpixel(x1 * one, y1 * one, x2 * one, y2 * one, x3 * one, y3 * one, cha, col);
+	}
+
+	// fixed point screen position, SubpixelBits of fraction. The centre of
+	// cell (x, y) lands on whole numbers so a cell is drawn when its centre
+	// is covered. Any two triangles snapping the same float get the same
+	// vertex, so shared edges meet without gaps or cells drawn twice
+	static const int SubpixelBits = 4;
+
+	static int ToSubpixel(float v)
+	{
+		return (int)floorf((v - 0.5f) * (float)(1 << SubpixelBits) + 0.5f);
+	}
+
+	// corners in the fixed point of ToSubpixel
+	void FillTriangleSubpixel(int x1, int y1, int x2, int y2, int x3, int y3, short cha = 0x2588, short col = 0x000F)
+	{
+		RasterizeTriangle(x1, y1, x2, y2, x3, y3, 0, 0, screenWidth, screenHeight,
+			[&](int x, int y, unsigned mask)
+			{
+				CHAR_INFO* cell = &screenBuffer[x + y * screenWidth];
+				for (int i = 0; i < 4; ++i)
+				{
+					if (mask & (1u << i))
+					{
+						cell[i].Char.UnicodeChar = cha;
+						cell[i].Attributes = col;
+					}
+				}
+			});
+	}
+
+	// corners are fixed point ( see ToSubpixel ), the rect is in cells.
+	// Walks the triangle's bounding box, clipped to [left, right) x [top, bottom),
+	// in 8x8 blocks. Blocks completely inside all three edges are handed out
+	// without testing, blocks completely outside one edge are skipped and the
+	// rest are tested 4 cells per SSE step. Coverage is reported to
+	// shade(x, y, mask) for runs of 4 cells starting at x, bit i of mask set
+	// when cell x + i is covered. Clipping to a rect lets screen tiles be
+	// rasterized on separate threads, and since the shader gets the cell
+	// position it can step depth or any other attribute along the run.
+	// Edge values are kept in 32 bits, which holds for triangles up to about
+	// 2000 cells across, the guard band keeps them well under that
+	template<typename Shader>
+	void RasterizeTriangle(int x1, int y1, int x2, int y2, int x3, int y3,
+		int left, int top, int right, int bottom, Shader&& shade)
+	{
+		// keep the winding consistent so inside is always positive
+		int64_t area = (int64_t)(x2 - x1) * (y3 - y1) - (int64_t)(y2 - y1) * (x3 - x1);
+		if (area == 0)
+			return;
+		if (area < 0)
+		{
+			std::swap(x2, x3);
+			std::swap(y2, y3);
+		}
+
+		// cells whose centre can be inside, rounding towards the inside
+		const int one = 1 << SubpixelBits;
+		int minX = max((min(x1, min(x2, x3)) + one - 1) >> SubpixelBits, left);
+		int maxX = min(max(x1, max(x2, x3)) >> SubpixelBits, right - 1);
+		int minY = max((min(y1, min(y2, y3)) + one - 1) >> SubpixelBits, top);
+		int maxY = min(max(y1, max(y2, y3)) >> SubpixelBits, bottom - 1);
+		if (minX > maxX || minY > maxY)
+			return;
+
+		// edges are set up around the box's first cell where the products
+		// stay small, then moved so At takes screen cells. a and b are the
+		// steps per cell
+		struct Edge
+		{
+			int a, b, c;
+			int At(int x, int y) const { return a * x + b * y + c; }
+		};
+
+		const int originX = minX * one;
+		const int originY = minY * one;
+
+		// cells exactly on an edge only belong to the triangle when it is a
+		// top or left edge, nudge the others in by one
+		auto setup = [&](int ax, int ay, int bx, int by)
+		{
+			ax -= originX; ay -= originY;
+			bx -= originX; by -= originY;
+			Edge e{ (ay - by) * one, (bx - ax) * one, ax * by - ay * bx };
+			if (!(ay - by > 0 || (ay == by && bx - ax > 0)))
+				e.c -= 1;
+			e.c -= e.a * minX + e.b * minY;
+			return e;
+		};
+
+		const Edge edges[3] = { setup(x1, y1, x2, y2), setup(x2, y2, x3, y3), setup(x3, y3, x1, y1) };
+
+		// edge value of the four cells in a run relative to the first
+		__m128i lanes[3];
+		for (int k = 0; k < 3; ++k)
+			lanes[k] = _mm_setr_epi32(0, edges[k].a, 2 * edges[k].a, 3 * edges[k].a);
+
+		for (int by = minY; by <= maxY; by += 8)
+		{
+			int blockBottom = min(by + 7, maxY);
+
+			for (int bx = minX; bx <= maxX; bx += 8)
+			{
+				int blockRight = min(bx + 7, maxX);
+
+				// edge functions are linear, so the corners decide for the block
+				bool accept = true;
+				bool reject = false;
+				for (int k = 0; k < 3 && !reject; ++k)
+				{
+					int c00 = edges[k].At(bx, by);
+					int c10 = edges[k].At(blockRight, by);
+					int c01 = edges[k].At(bx, blockBottom);
+					int c11 = edges[k].At(blockRight, blockBottom);
+					if ((c00 | c10 | c01 | c11) < 0)
+						accept = false;
+					if ((c00 & c10 & c01 & c11) < 0)
+						reject = true;
+				}
+
+				if (reject)
+					continue;
+
+				int width = blockRight - bx + 1;
+				unsigned limit[2] = {
+					width >= 4 ? 0xFu : (1u << width) - 1,
+					width >= 8 ? 0xFu : width > 4 ? (1u << (width - 4)) - 1 : 0u
+				};
+
+				if (accept)
+				{
+					for (int y = by; y <= blockBottom; ++y)
+					{
+						shade(bx, y, limit[0]);
+						if (limit[1])
+							shade(bx + 4, y, limit[1]);
+					}
+					continue;
+				}
+
+				int row[3] = { edges[0].At(bx, by), edges[1].At(bx, by), edges[2].At(bx, by) };
+				for (int y = by; y <= blockBottom; ++y)
+				{
+					for (int g = 0; g < 2 && limit[g]; ++g)
+					{
+						__m128i w0 = _mm_add_epi32(_mm_set1_epi32(row[0] + 4 * g * edges[0].a), lanes[0]);
+						__m128i w1 = _mm_add_epi32(_mm_set1_epi32(row[1] + 4 * g * edges[1].a), lanes[1]);
+						__m128i w2 = _mm_add_epi32(_mm_set1_epi32(row[2] + 4 * g * edges[2].a), lanes[2]);
+
+						// a cell is out as soon as one edge goes negative
+						__m128i outside = _mm_or_si128(_mm_or_si128(w0, w1), w2);
+						unsigned mask = ~(unsigned)_mm_movemask_ps(_mm_castsi128_ps(outside)) & limit[g];
+						if (mask)
+							shade(bx + 4 * g, y, mask);
+					}
+
+					row[0] += edges[0].b;
+					row[1] += edges[1].b;
+					row[2] += edges[2].b;
+				}
+			}
+		}
+	}
+
 	void DrawCircle(int xc, int yc, int r, short cha = 0x2588, short col = 0x000F)
 	{
 		int x{};
@@ -633,43 +1279,81 @@ public:
 		}
 	}
 
-	void DrawWireFrame(const std::vector<std::pair<float, float>>& coordinates,
-		float x, float y, float r = 0.0f, float s = 1.0f, short col = FG_White, short cha = Solid)
+	// closed polygon through the model's points, rotated by r, scaled by s
+	// and moved to (x, y), wrapping round the screen edges when wrap is set.
+	// The scale is folded into one cos/sin pair for the whole model, and
+	// each point is transformed as its edge is drawn so nothing is stored
+	// between them
+	void DrawWireFrame(const std::vector<Vector2>& coordinates,
+		float x, float y, float r = 0.0f, float s = 1.0f, short col = FG_White, short cha = Solid, bool wrap = false)
 	{
-		std::vector<std::pair<float, float>> transformed;
 		int vertices = coordinates.size();
-		transformed.resize(vertices);
+		if (vertices == 0)
+			return;
 
-		// rotate
-		for (int i = 0; i < vertices; ++i)
-		{
-			transformed[i].first = coordinates[i].first * cosf(r) - coordinates[i].second * sinf(r);
-			transformed[i].second = coordinates[i].first * sinf(r) + coordinates[i].second * cosf(r);
-		}
+		const float cosR = cosf(r) * s;
+		const float sinR = sinf(r) * s;
+		const Vector2 offset{ x, y };
 
-		// scale
-		for (int i = 0; i < vertices; ++i)
+		const Vector2 first = Vector2_Add(Vector2_Rotate(coordinates[0], cosR, sinR), offset);
+		Vector2 previous = first;
+		for (int i = 1; i <= vertices; ++i)
 		{
-			transformed[i].first = coordinates[i].first * s;
-			transformed[i].second = coordinates[i].second * s;
+			Vector2 current = i < vertices ? Vector2_Add(Vector2_Rotate(coordinates[i], cosR, sinR), offset) : first;
+			if (wrap)
+				DrawLineWrapped((int)previous.x, (int)previous.y, (int)current.x, (int)current.y, cha, col);
+			else
+				DrawLine((int)previous.x, (int)previous.y, (int)current.x, (int)current.y, cha, col);
+			previous = current;
 		}
+	}
 
-		// translate
-		for (int i = 0; i < vertices; ++i)
+	// every live particle as one cell, its glyph thinning from Solid to
+	// OneQuater as its life runs out. Positions and fade levels are worked
+	// out four at a time and written straight into the buffer, anything off
+	// screen is skipped
+	void DrawParticles(const ParticleSystem& particles)
+	{
+		static const short glyphs[4] = { OneQuater, TwoQuaters, ThreeQuaters, Solid };
+
+		const float* px = particles.x.data();
+		const float* py = particles.y.data();
+		const float* life = particles.life.data();
+		const float* fade = particles.fade.data();
+		const short* col = particles.col.data();
+		const int count = particles.count;
+		const unsigned width = (unsigned)screenWidth;
+		const unsigned height = (unsigned)screenHeight;
+		const __m128 levels = _mm_set1_ps(3.999f);
+
+		int i = 0;
+		alignas(16) int cx[4], cy[4], level[4];
+		for (; i + 4 <= count; i += 4)
 		{
-			transformed[i].first = coordinates[i].first + x;
-			transformed[i].second = coordinates[i].second + y;
+			_mm_store_si128((__m128i*)cx, _mm_cvttps_epi32(_mm_loadu_ps(&px[i])));
+			_mm_store_si128((__m128i*)cy, _mm_cvttps_epi32(_mm_loadu_ps(&py[i])));
+			__m128 f = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(&life[i]), _mm_loadu_ps(&fade[i])), levels);
+			_mm_store_si128((__m128i*)level, _mm_cvttps_epi32(_mm_min_ps(f, levels)));
+			for (int k = 0; k < 4; ++k)
+			{
+				if ((unsigned)cx[k] < width && (unsigned)cy[k] < height)
+				{
+					CHAR_INFO& cell = screenBuffer[cx[k] + cy[k] * screenWidth];
+					cell.Char.UnicodeChar = glyphs[level[k]];
+					cell.Attributes = col[i + k];
+				}
+			}
 		}
-
-		// draw polygon
-		for (int i = 0; i < vertices; ++i)
+		for (; i < count; ++i)
 		{
-			int j = i + 1;
-			DrawLine(
-				(int)transformed[i % vertices].first, (int)transformed[i % vertices].second,
-				(int)transformed[j % vertices].first, (int)transformed[j % vertices].second,
-				cha, col
-			);
+			int x = (int)px[i];
+			int y = (int)py[i];
+			if ((unsigned)x < width && (unsigned)y < height)
+			{
+				CHAR_INFO& cell = screenBuffer[x + y * screenWidth];
+				cell.Char.UnicodeChar = glyphs[min(3, (int)(life[i] * fade[i] * 3.999f))];
+				cell.Attributes = col[i];
+			}
 		}
 	}
 
@@ -803,12 +1487,26 @@ private:
 					mouseOldState[m] = mouseNewState[m];
 				}
 
+				frameArena.Reset();
+				screenUnchanged = false;
+
 				if (!OnUpdate(elapsedTime))
 					atomActive = false;
 
+				// nothing new to show, give the cpu back instead of spinning
+				if (screenUnchanged)
+				{
+					Sleep(idleSleep);
+					continue;
+				}
+
 				// display status
 				wchar_t title[256];
-				swprintf_s(title, 256, L"Console69 %s FPS: %3.2f", appName.c_str(), 1.0f / elapsedTime);
+				if (frameArena.GetHighWaterMark() > 0)
+					swprintf_s(title, 256, L"Console69 %s FPS: %3.2f Arena: %u/%u KB", appName.c_str(), 1.0f / elapsedTime,
+						(unsigned)(frameArena.GetHighWaterMark() / 1024), (unsigned)(frameArena.GetCapacity() / 1024));
+				else
+					swprintf_s(title, 256, L"Console69 %s FPS: %3.2f", appName.c_str(), 1.0f / elapsedTime);
 				SetConsoleTitle(title);
 				WriteConsoleOutput(
 					console, screenBuffer, 
@@ -866,6 +1564,17 @@ protected:
 	bool consoleFocused = true;
 	bool audioEnabled = false;
 
+	WorkerPool workers;
+
+	// transient per-frame storage, reset before every OnUpdate
+	FrameArena frameArena;
+
+	// OnUpdate sets this when screenBuffer still holds last frame's picture,
+	// the frame is then neither presented nor titled and the thread sleeps
+	// for idleSleep milliseconds before polling input again
+	bool screenUnchanged = false;
+	DWORD idleSleep = 10;
+
 protected:
 	int Error(const wchar_t* msg)
 	{
@@ -1,155 +1,640 @@
 #pragma once
 #include "Console69.h"
 
-#include <stack>
+#include <fstream>
 
-class Maze : public Console69
+// maze files are this header then height rows of EllerGenerator::GetRowBytes
+// bytes, 2 bits a cell for the openings east and south. North and west are
+// the cell above's south and the cell left's east
+struct MazeFileHeader
+{
+	char magic[4];
+	int32_t width;
+	int32_t height;
+};
+
+enum MazeFileCell
+{
+	MazeFile_E = 0x01,
+	MazeFile_S = 0x02,
+};
+
+// a maze as 4 bits a cell, which sides are open, two cells to a byte, plus
+// a bitmap of the cells a generator has reached. Half a byte and a bit a
+// cell, so a few hundred million cells fit in a few hundred MB. Cells are
+// addressed x + y * width
+class MazeGrid
 {
 public:
-	Maze()
+	enum Path
 	{
-		appName = L"Maze";
+		Path_N = 0x01,
+		Path_E = 0x02,
+		Path_S = 0x04,
+		Path_W = 0x08,
+	};
+
+	void Create(int w, int h)
+	{
+		width = w;
+		height = h;
+		const size_t count = (size_t)w * (size_t)h;
+		paths.assign((count + 1) / 2, 0);
+		visited.assign((count + 63) / 64, 0);
 	}
 
-private:
-	int width;
-	int height;
-	int* maze;
+	int GetWidth() const { return width; }
+	int GetHeight() const { return height; }
+	size_t GetCellCount() const { return (size_t)width * (size_t)height; }
 
-	enum Cell
+	int GetPaths(size_t cell) const
 	{
-		Cell_Path_N = 0x01,
-		Cell_Path_E = 0x02,
-		Cell_Path_S = 0x04,
-		Cell_Path_W = 0x08,
-		Cell_Visited = 0x10,
-	};
+		return (paths[cell >> 1] >> ((cell & 1) * 4)) & 0x0F;
+	}
 
-	int visitedCells;
-	std::stack<std::pair<int, int>> stack;
-	int pathWidth;
+	void Open(size_t cell, int path)
+	{
+		paths[cell >> 1] |= (uint8_t)(path << ((cell & 1) * 4));
+	}
 
-protected:
-	virtual bool OnAwake() override
+	bool IsVisited(size_t cell) const
 	{
-		width = 40;
-		height = 25;
-		maze = new int[width * height];
-		memset(maze, 0x00, width * height * sizeof(int));
-		pathWidth = 3;
+		return (visited[cell >> 6] >> (cell & 63)) & 1;
+	}
 
-		int x = rand() % width;
-		int y = rand() % height;
-		stack.push(std::make_pair(x, y));
-		maze[x + y * width] = Cell_Visited;
+	void SetVisited(size_t cell)
+	{
+		visited[cell >> 6] |= 1ull << (cell & 63);
+	}
+
+	size_t GetMemoryUsed() const
+	{
+		return paths.size() * sizeof(uint8_t) + visited.size() * sizeof(uint64_t);
+	}
+
+	// a whole maze file into memory, every cell counts as visited
+	bool Load(const std::string& filename)
+	{
+		std::ifstream file(filename, std::ios::binary);
+		if (!file.is_open())
+			return false;
+
+		MazeFileHeader header{};
+		file.read((char*)&header, sizeof(header));
+		if (!file || memcmp(header.magic, "MAZE", 4) != 0 || header.width <= 0 || header.height <= 0)
+			return false;
+
+		Create(header.width, header.height);
+		std::fill(visited.begin(), visited.end(), ~0ull);
+
+		std::vector<uint8_t> row((header.width + 3) / 4);
+		for (int y = 0; y < header.height; ++y)
+		{
+			file.read((char*)row.data(), row.size());
+			if (!file)
+				return false;
+
+			for (int x = 0; x < header.width; ++x)
+			{
+				const int open = (row[x >> 2] >> ((x & 3) * 2)) & 0x03;
+				const size_t cell = (size_t)x + (size_t)y * width;
+				if ((open & MazeFile_E) && x + 1 < width)
+				{
+					Open(cell, Path_E);
+					Open(cell + 1, Path_W);
+				}
+				if ((open & MazeFile_S) && y + 1 < height)
+				{
+					Open(cell, Path_S);
+					Open(cell + width, Path_N);
+				}
+			}
+		}
+		return true;
+	}
+
+	// exactly one way between any two cells: one opening fewer than there
+	// are cells, and every cell reachable from the first. The fill reuses
+	// the visited bitmap, so it's left marking what was reached
+	bool IsPerfect()
+	{
+		const size_t count = GetCellCount();
+		if (count == 0 || count > UINT32_MAX)
+			return false;
+
+		size_t openings = 0;
+		for (size_t cell = 0; cell < count; ++cell)
+		{
+			const int open = GetPaths(cell);
+			openings += ((open & Path_E) ? 1 : 0) + ((open & Path_S) ? 1 : 0);
+		}
+		if (openings != count - 1)
+			return false;
+
+		std::fill(visited.begin(), visited.end(), 0ull);
+		std::vector<uint32_t> stack{ 0 };
+		SetVisited(0);
+		size_t reached = 1;
+		while (!stack.empty())
+		{
+			const uint32_t cell = stack.back();
+			stack.pop_back();
+
+			const int open = GetPaths(cell);
+			const uint32_t next[4] = { cell - width, cell + 1, cell + width, cell - 1 };
+			for (int d = 0; d < 4; ++d)
+			{
+				if ((open & (1 << d)) && !IsVisited(next[d]))
+				{
+					SetVisited(next[d]);
+					stack.push_back(next[d]);
+					++reached;
+				}
+			}
+		}
+		return reached == count;
+	}
+
+private:
+	int width{};
+	int height{};
+	std::vector<uint8_t> paths;
+	std::vector<uint64_t> visited;
+};
+
+// recursive backtracker without the recursion. The path back is a flat
+// stack of cell indices, the top is read once a step and the neighbours are
+// checked against the visited bitmap. Indices are 32 bit, so up to 4G
+// cells. Random numbers come from its own xorshift so a seed gives the same
+// maze on every platform
+class MazeGenerator
+{
+public:
+	// false for an empty grid, one past the 32 bit indices or a start cell
+	// outside it
+	bool Start(MazeGrid& g, size_t cell, unsigned s)
+	{
+		stack.clear();
+		const size_t count = g.GetCellCount();
+		if (g.GetWidth() <= 0 || g.GetHeight() <= 0 || count > UINT32_MAX || cell >= count)
+			return false;
+
+		grid = &g;
+		seed = s != 0 ? s : 0x2545F491;
+		stack.push_back((uint32_t)cell);
+		grid->SetVisited(cell);
 		visitedCells = 1;
+		deepest = 1;
+		return true;
+	}
+
+	// carve into a random unvisited neighbour of the top, or back up one.
+	// False once every cell has been reached
+	bool Step()
+	{
+		if (IsDone())
+			return false;
+
+		const int width = grid->GetWidth();
+		const int height = grid->GetHeight();
+		const uint32_t top = stack.back();
+		const int x = (int)(top % (uint32_t)width);
+		const int y = (int)(top / (uint32_t)width);
 
+		uint32_t next[4];
+		int from[4];
+		int to[4];
+		int count = 0;
+
+		// N
+		if (y > 0 && !grid->IsVisited(top - width))
+		{
+			next[count] = top - width; from[count] = MazeGrid::Path_N; to[count++] = MazeGrid::Path_S;
+		}
+		// E
+		if (x < width - 1 && !grid->IsVisited(top + 1))
+		{
+			next[count] = top + 1; from[count] = MazeGrid::Path_E; to[count++] = MazeGrid::Path_W;
+		}
+		// S
+		if (y < height - 1 && !grid->IsVisited(top + width))
+		{
+			next[count] = top + width; from[count] = MazeGrid::Path_S; to[count++] = MazeGrid::Path_N;
+		}
+		// W
+		if (x > 0 && !grid->IsVisited(top - 1))
+		{
+			next[count] = top - 1; from[count] = MazeGrid::Path_W; to[count++] = MazeGrid::Path_E;
+		}
+
+		if (count > 0)
+		{
+			int pick = count > 1 ? (int)(Random() % (unsigned)count) : 0;
+
+			// create a path between the neighbour and the current cell
+			grid->Open(top, from[pick]);
+			grid->Open(next[pick], to[pick]);
+			grid->SetVisited(next[pick]);
+			stack.push_back(next[pick]);
+			++visitedCells;
+			deepest = max(deepest, stack.size());
+		}
+		else
+		{
+			// no available neighbours so backtrack
+			stack.pop_back();
+		}
 		return true;
 	}
 
-	virtual bool OnUpdate(float deltaTime) override
+	// up to steps steps, how many were taken
+	size_t Run(size_t steps)
+	{
+		size_t taken = 0;
+		while (taken < steps && Step())
+			++taken;
+		return taken;
+	}
+
+	bool IsDone() const { return stack.empty() || visitedCells == grid->GetCellCount(); }
+
+	// the cell the generator is at, it stays on the last one carved once done
+	bool HasCurrent() const { return !stack.empty(); }
+	size_t GetCurrent() const { return stack.back(); }
+
+	size_t GetVisitedCount() const { return visitedCells; }
+	size_t GetDeepestStack() const { return deepest; }
+
+	// the stack only grows during a run, so its capacity is its high water mark
+	size_t GetMemoryUsed() const { return stack.capacity() * sizeof(uint32_t); }
+
+private:
+	unsigned Random()
+	{
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		return seed;
+	}
+
+	MazeGrid* grid = nullptr;
+	std::vector<uint32_t> stack;
+	size_t visitedCells = 0;
+	size_t deepest = 0;
+	unsigned seed = 0x2545F491;
+};
+
+// Eller's algorithm, the maze a row at a time from nothing but the row
+// before. Cells of the row in the same set are linked round a circular list
+// through left and right. Sets never cross each other, so c and c + 1 are
+// in the same set exactly when right[c] == c + 1, and memory is O(width)
+// however tall the maze gets
+class EllerGenerator
+{
+public:
+	static int GetRowBytes(int width) { return (width + 3) / 4; }
+
+	// what Generate really splits height rows into, at least one band and
+	// no more than a row each
+	static int GetBandCount(int bands, int height) { return max(1, min(bands, height)); }
+
+	void Start(int w, unsigned s)
+	{
+		width = w;
+		seed = s != 0 ? s : 0x2545F491;
+		left.resize(w);
+		right.resize(w);
+		for (int c = 0; c < w; ++c)
+			left[c] = right[c] = c;
+	}
+
+	// the next row in maze file form, GetRowBytes(width) bytes. The last row
+	// joins every set left so the maze comes out whole. A column in down
+	// always opens south, that's how bands are stitched to the next one
+	void NextRow(uint8_t* row, bool last, int down = -1)
 	{
-		Sleep(10);
+		memset(row, 0, GetRowBytes(width));
 
-		auto offset = [&](int x, int y)
+		// join neighbours that aren't connected yet, at random or on the
+		// last row all of them. The choices are coin flips the branch
+		// predictor can't learn, so both loops pick values instead of
+		// branching, and a cell left alone gets its own links written back
+		int* l = left.data();
+		int* r = right.data();
+		for (int c = 0; c + 1 < width; ++c)
 		{
-			return (stack.top().first + x) + (stack.top().second + y) * width;
-		};
+			const int a = r[c];
+			const int b = l[c + 1];
+			const bool join = a != c + 1 && (last | Coin());
+			l[a] = join ? b : l[a];
+			r[b] = join ? a : r[b];
+			r[c] = join ? c + 1 : r[c];
+			l[c + 1] = join ? c : l[c + 1];
+			row[c >> 2] |= (uint8_t)((int)join * MazeFile_E << ((c & 3) * 2));
+		}
 
-		// wikipedia research Kappa
-		if (visitedCells < width * height)
+		// every set has to carry on south somewhere, so only a cell that
+		// isn't alone in its set may stop. It leaves the set and starts a
+		// new one of its own on the next row
+		for (int c = 0; c < width; ++c)
 		{
-			std::vector<int> neighbours;
+			const int a = l[c];
+			const int b = r[c];
+			const bool stop = c != down && (last | ((c != a) & Coin()));
+			r[a] = stop ? b : r[a];
+			l[b] = stop ? a : l[b];
+			l[c] = stop ? c : l[c];
+			r[c] = stop ? c : r[c];
+			row[c >> 2] |= (uint8_t)((int)!stop * MazeFile_S << ((c & 3) * 2));
+		}
+	}
 
-			// N
-			if (stack.top().second > 0 && (maze[offset(0, -1)] & Cell_Visited) == 0)
-				neighbours.push_back(0);
-			// E
-			if (stack.top().first < width - 1 && (maze[offset(1, 0)] & Cell_Visited) == 0)
-				neighbours.push_back(1);
-			// S
-			if (stack.top().second < height - 1 && (maze[offset(0, 1)] & Cell_Visited) == 0)
-				neighbours.push_back(2);
-			// W
-			if (stack.top().first > 0 && (maze[offset(-1, 0)] & Cell_Visited) == 0)
-				neighbours.push_back(3);
+	// width x height maze straight to a maze file. With more than one band
+	// the rows are split between the worker threads, every band is a maze
+	// of its own written into its place in the file, and each one opens
+	// south into the next at a single column so the whole is still one maze
+	static bool Generate(const std::string& filename, int width, int height, unsigned seed, int bands = 1)
+	{
+		if (width <= 0 || height <= 0)
+			return false;
+
+		bands = GetBandCount(bands, height);
+		const int rowBytes = GetRowBytes(width);
+		const MazeFileHeader header{ { 'M', 'A', 'Z', 'E' }, width, height };
 
-			if (!neighbours.empty())
+		// sized up front so every band can seek straight to its rows
+		{
+			std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+			file.write((const char*)&header, sizeof(header));
+			file.seekp((std::streamoff)sizeof(header) + (std::streamoff)rowBytes * height - 1);
+			file.put(0);
+			if (!file.good())
+				return false;
+		}
+
+		EllerGenerator stitch;
+		stitch.Start(1, seed);
+		std::vector<int> stitches(bands);
+		for (int& column : stitches)
+			column = (int)(stitch.Random() % (unsigned)width);
+
+		std::atomic<bool> good{ true };
+		WorkerPool pool;
+		pool.ParallelFor(bands, [&](int band)
 			{
-				int next_cell_dir = neighbours[rand() % neighbours.size()];
+				const int first = (int)((long long)height * band / bands);
+				const int end = (int)((long long)height * (band + 1) / bands);
 
-				// create a path between the neighbour and the current cell
-				switch (next_cell_dir)
-				{
-				case 0: // N
-					maze[offset(0, -1)] |= Cell_Visited | Cell_Path_S;
-					maze[offset(0, 0)] |= Cell_Path_N;
-					stack.push(std::make_pair((stack.top().first + 0), (stack.top().second - 1)));
-					break;
-
-				case 1: // E
-					maze[offset(+1, 0)] |= Cell_Visited | Cell_Path_W;
-					maze[offset(0, 0)] |= Cell_Path_E;
-					stack.push(std::make_pair((stack.top().first + 1), (stack.top().second + 0)));
-					break;
-
-				case 2: // S
-					maze[offset(0, +1)] |= Cell_Visited | Cell_Path_N;
-					maze[offset(0, 0)] |= Cell_Path_S;
-					stack.push(std::make_pair((stack.top().first + 0), (stack.top().second + 1)));
-					break;
-
-				case 3: // W
-					maze[offset(-1, 0)] |= Cell_Visited | Cell_Path_E;
-					maze[offset(0, 0)] |= Cell_Path_W;
-					stack.push(std::make_pair((stack.top().first - 1), (stack.top().second + 0)));
-					break;
+				std::fstream file(filename, std::ios::binary | std::ios::in | std::ios::out);
+				file.seekp((std::streamoff)sizeof(header) + (std::streamoff)rowBytes * first);
+
+				EllerGenerator generator;
+				generator.Start(width, seed + (unsigned)band * 0x9E3779B9u);
 
+				// rows go out about a MB at a time
+				const int chunkRows = max(1, (1 << 20) / rowBytes);
+				std::vector<uint8_t> chunk((size_t)chunkRows * rowBytes);
+				for (int y = first; y < end;)
+				{
+					const int rows = min(chunkRows, end - y);
+					for (int r = 0; r < rows; ++r, ++y)
+					{
+						const bool last = y == end - 1;
+						const int down = last && band + 1 < bands ? stitches[band] : -1;
+						generator.NextRow(&chunk[(size_t)r * rowBytes], last, down);
+					}
+					file.write((const char*)chunk.data(), (std::streamsize)rows * rowBytes);
 				}
 
-				++visitedCells;
+				if (!file.good())
+					good = false;
+			});
+
+		return good;
+	}
+
+private:
+	unsigned Random()
+	{
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		return seed;
+	}
+
+	// one random bit, 32 to a number
+	bool Coin()
+	{
+		if (bits == 0)
+		{
+			coins = Random();
+			bits = 32;
+		}
+		--bits;
+		bool heads = coins & 1;
+		coins >>= 1;
+		return heads;
+	}
+
+	int width = 0;
+	std::vector<int> left;
+	std::vector<int> right;
+	unsigned seed = 0x2545F491;
+	unsigned coins = 0;
+	int bits = 0;
+};
+
+class Maze : public Console69
+{
+public:
+	// cellSize is the width of a path in screen cells, walls take one more
+	Maze(int mazeWidth = 40, int mazeHeight = 25, int cellSize = 3)
+		:
+		width{ mazeWidth }, height{ mazeHeight }, pathWidth{ cellSize }
+	{
+		appName = L"Maze";
+	}
+
+	// how much generating one frame does, a number of steps, or with a time
+	// slice in milliseconds as many steps as fit in it
+	void SetStepsPerFrame(int steps)
+	{
+		stepsPerFrame = max(1, steps);
+		timeSlice = 0.0f;
+	}
+
+	void SetTimeSlice(float milliseconds)
+	{
+		timeSlice = milliseconds;
+	}
+
+	// headless, generates a width x height maze start to finish and reports
+	// the time and the memory it took
+	static void RunBenchmark(int w, int h, unsigned seed)
+	{
+		if (w <= 0 || h <= 0 || (uint64_t)w * (uint64_t)h > UINT32_MAX)
+		{
+			wprintf(L"Maze benchmark: %d x %d is not a size the generator can do\n", w, h);
+			return;
+		}
+
+		MazeGrid grid;
+		MazeGenerator generator;
+
+		auto start = std::chrono::steady_clock::now();
+		grid.Create(w, h);
+		generator.Start(grid, 0, seed);
+		size_t steps = 0;
+		while (generator.Step())
+			++steps;
+		auto end = std::chrono::steady_clock::now();
+
+		const double ms = std::chrono::duration<double, std::milli>(end - start).count();
+		wprintf(L"Maze benchmark: %d x %d, %zu cells\n", w, h, grid.GetCellCount());
+		wprintf(L"  %zu steps in %.1f ms, %.1f ns/step\n", steps, ms, ms * 1e6 / max((size_t)1, steps));
+		wprintf(L"  grid %.1f MB, stack %.1f MB, deepest %zu\n",
+			grid.GetMemoryUsed() / 1048576.0, generator.GetMemoryUsed() / 1048576.0, generator.GetDeepestStack());
+	}
+
+	// headless, streams a width x height maze to a file with Eller's
+	// algorithm split over bands and reports how fast it went. With verify
+	// the file is read back and checked to be one perfect maze
+	static void RunFileBenchmark(const std::string& filename, int w, int h, int bands, unsigned seed, bool verify = false)
+	{
+		auto start = std::chrono::steady_clock::now();
+		bool written = EllerGenerator::Generate(filename, w, h, seed, bands);
+		auto end = std::chrono::steady_clock::now();
+
+		const double ms = std::chrono::duration<double, std::milli>(end - start).count();
+		const double mb = ((double)EllerGenerator::GetRowBytes(w) * h + sizeof(MazeFileHeader)) / 1048576.0;
+		wprintf(L"Maze file: %d x %d in %d bands%ls\n", w, h, EllerGenerator::GetBandCount(bands, h), written ? L"" : L", FAILED");
+		wprintf(L"  %.1f MB in %.1f ms, %.1f MB/s\n", mb, ms, mb * 1000.0 / max(ms, 0.001));
+
+		if (verify && written)
+		{
+			MazeGrid grid;
+			bool loaded = grid.Load(filename);
+			wprintf(L"  read back %ls\n", !loaded ? L"FAILED" : grid.IsPerfect() ? L"as a perfect maze" : L"but NOT a perfect maze");
+		}
+	}
+
+private:
+	int width;
+	int height;
+	int pathWidth;
+
+	MazeGrid grid;
+	MazeGenerator generator;
+
+	int stepsPerFrame = 1;
+	float timeSlice = 0.0f;
+
+	// cells a step changed since they were last drawn, only these are
+	// redrawn. The first frame draws the whole maze
+	std::vector<size_t> dirty;
+	bool drawn = false;
+
+protected:
+	virtual bool OnAwake() override
+	{
+		if (width <= 0 || height <= 0)
+			return false;
+
+		grid.Create(width, height);
+
+		int x = rand() % width;
+		int y = rand() % height;
+		return generator.Start(grid, (size_t)x + (size_t)y * width, (unsigned)rand());
+	}
+
+	virtual bool OnUpdate(float deltaTime) override
+	{
+		if (!generator.IsDone())
+		{
+			if (timeSlice > 0.0f)
+			{
+				// the clock is only read every so many steps
+				auto start = std::chrono::steady_clock::now();
+				auto end = start + std::chrono::microseconds((long long)(timeSlice * 1000.0f));
+				while (!generator.IsDone())
+				{
+					for (int i = 0; i < 64 && !generator.IsDone(); ++i)
+						Step();
+					if (std::chrono::steady_clock::now() >= end)
+						break;
+				}
 			}
 			else
 			{
-				// no available neighbours so backtrack
-				stack.pop();
+				for (int i = 0; i < stepsPerFrame && !generator.IsDone(); ++i)
+					Step();
 			}
 		}
+		else if (drawn)
+		{
+			// finished and already on screen
+			screenUnchanged = true;
+			return true;
+		}
 
 		// draw
-		Fill(0, 0, GetScreenWidth(), GetScreenHeight(), L' ');
-
-		for (int x = 0; x < width; ++x)
+		if (!drawn)
 		{
+			Fill(0, 0, GetScreenWidth(), GetScreenHeight(), L' ');
 			for (int y = 0; y < height; ++y)
-			{
-				for (int py = 0; py < pathWidth; ++py)
-				{
-					for (int px = 0; px < pathWidth; ++px)
-					{
-						if (maze[x + y * width] & Cell_Visited)
-							Draw(x * (pathWidth + 1) + px, y * (pathWidth + 1) + py, Solid, FG_White);
-						else
-							Draw(x * (pathWidth + 1) + px, y * (pathWidth + 1) + py, Solid, FG_Blue);
-					}
-				}
+				for (int x = 0; x < width; ++x)
+					DrawCell(x, y);
+			dirty.clear();
+			drawn = true;
+		}
 
-				for (int p = 0; p < pathWidth; ++p)
-				{
-					if (maze[x + y * width] & Cell_Path_S)
-						Draw(x * (pathWidth + 1) + p, y * (pathWidth + 1) + pathWidth);
+		for (size_t cell : dirty)
+			DrawCell((int)(cell % width), (int)(cell / width));
+		dirty.clear();
 
-					if (maze[x + y * width] & Cell_Path_E)
-						Draw(x * (pathWidth + 1) + pathWidth, y * (pathWidth + 1) + p);
-				}
-			}
+		// the generator's cell was one of the dirty ones or is the one
+		// uncovered by the last backtrack, so it's always drawn over in time
+		if (generator.HasCurrent())
+		{
+			const int x = (int)(generator.GetCurrent() % width);
+			const int y = (int)(generator.GetCurrent() / width);
+			for (int py = 0; py < pathWidth; ++py)
+				for (int px = 0; px < pathWidth; ++px)
+					Draw(x * (pathWidth + 1) + px, y * (pathWidth + 1) + py, Solid, FG_Green);
 		}
 
+		return true;
+	}
+
+	// one generator step, the cell it was at and the one it ends up at are
+	// the only ones it can change
+	void Step()
+	{
+		dirty.push_back(generator.GetCurrent());
+		generator.Step();
+		if (generator.HasCurrent())
+			dirty.push_back(generator.GetCurrent());
+	}
+
+	// the cell's block and the openings south and east of it, which are the
+	// only walls it owns. North and west belong to the neighbours
+	void DrawCell(int x, int y)
+	{
+		const size_t cell = (size_t)x + (size_t)y * width;
+		const int paths = grid.GetPaths(cell);
+		const short col = grid.IsVisited(cell) ? FG_White : FG_Blue;
+
 		for (int py = 0; py < pathWidth; ++py)
 			for (int px = 0; px < pathWidth; ++px)
-				Draw(stack.top().first * (pathWidth + 1) + px, stack.top().second * (pathWidth + 1) + py, Solid, FG_Green);
+				Draw(x * (pathWidth + 1) + px, y * (pathWidth + 1) + py, Solid, col);
 
+		for (int p = 0; p < pathWidth; ++p)
+		{
+			if (paths & MazeGrid::Path_S)
+				Draw(x * (pathWidth + 1) + p, y * (pathWidth + 1) + pathWidth);
 
-		return true;
+			if (paths & MazeGrid::Path_E)
+				Draw(x * (pathWidth + 1) + pathWidth, y * (pathWidth + 1) + p);
+		}
 	}
-};
\ No newline at end of file
+};
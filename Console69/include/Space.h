@@ -12,6 +12,110 @@ public:
 		appName = L"Space";
 	}
 
+	// headless stress run, no console window. A fixed seed spawns the rocks
+	// and bullets, bullets and particles are topped back up every frame, and
+	// the frame stages are timed separately over a fixed number of frames
+	struct BenchmarkSettings
+	{
+		int rocks = 1000;
+		int bullets = 100;
+		int particles = 20000;
+		int frames = 300;
+		bool render = true;
+		unsigned seed = 69;
+		int width = 256;
+		int height = 240;
+	};
+
+	void RunBenchmark(const BenchmarkSettings& settings)
+	{
+		screenWidth = settings.width;
+		screenHeight = settings.height;
+		screenBuffer = new CHAR_INFO[screenWidth * screenHeight];
+		memset(screenBuffer, 0, sizeof(CHAR_INFO) * screenWidth * screenHeight);
+
+		srand(settings.seed);
+		OnAwake();
+
+		const float width = (float)screenWidth;
+		const float height = (float)screenHeight;
+		auto random = [] { return (float)rand() / (float)RAND_MAX; };
+
+		// a mix of the three sizes, every one of them can still break up
+		rocks.Clear();
+		rocks.Reserve(settings.rocks * 4);
+		for (int i = 0; i < settings.rocks; ++i)
+		{
+			float heading = random() * 6.283185f;
+			rocks.Add(4 << (rand() % 3), random() * width, random() * height,
+				10.0f * sinf(heading), 10.0f * cosf(heading), random() * 6.283185f);
+		}
+
+		bullets.Clear();
+		bullets.Reserve(settings.bullets);
+		particles.Clear();
+		particles.Reserve(settings.particles + 256);
+
+		const float deltaTime = 1.0f / 60.0f;
+		double stage[5]{}; // integrate, collide, fragment, draw, effects
+		size_t hits = 0;
+		auto now = [] { return std::chrono::steady_clock::now(); };
+		auto add = [](double& total, std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+		{
+			total += std::chrono::duration<double, std::milli>(to - from).count();
+		};
+
+		for (int frame = 0; frame < settings.frames; ++frame)
+		{
+			while (bullets.count < settings.bullets)
+			{
+				float heading = random() * 6.283185f;
+				bullets.Add(0, 1.0f + random() * (width - 2.0f), 1.0f + random() * (height - 2.0f),
+					50.0f * sinf(heading), -50.0f * cosf(heading), 100.0f);
+			}
+			while (particles.GetCount() < settings.particles)
+				particles.Emit(min(256, settings.particles - particles.GetCount()), random() * width, random() * height,
+					0.0f, 0.0f, 0.0f, 6.283185f, 30.0f, 1.0f, FG_Yellow);
+
+			auto t0 = now();
+			Integrate(deltaTime);
+			auto t1 = now();
+			if (settings.render)
+				DrawRocksStage();
+			auto t2 = now();
+			Collide();
+			auto t3 = now();
+			hits += rockHits.size();
+			Fragment();
+			auto t4 = now();
+			UpdateEffects(deltaTime);
+			if (settings.render)
+				DrawEffects();
+			auto t5 = now();
+			if (settings.render)
+				DrawOverlay();
+			auto t6 = now();
+
+			add(stage[0], t0, t1);
+			add(stage[1], t2, t3);
+			add(stage[2], t3, t4);
+			add(stage[3], t1, t2);
+			add(stage[3], t5, t6);
+			add(stage[4], t4, t5);
+		}
+
+		const double frames = (double)max(1, settings.frames);
+		wprintf(L"Space benchmark: %d rocks, %d bullets, %d particles, %d frames%ls\n",
+			settings.rocks, settings.bullets, settings.particles, settings.frames, settings.render ? L"" : L", no drawing");
+		wprintf(L"  integrate %9.4f ms/frame\n", stage[0] / frames);
+		wprintf(L"  collide   %9.4f ms/frame\n", stage[1] / frames);
+		wprintf(L"  fragment  %9.4f ms/frame\n", stage[2] / frames);
+		wprintf(L"  draw      %9.4f ms/frame\n", stage[3] / frames);
+		wprintf(L"  effects   %9.4f ms/frame\n", stage[4] / frames);
+		wprintf(L"  total     %9.4f ms/frame\n", (stage[0] + stage[1] + stage[2] + stage[3] + stage[4]) / frames);
+		wprintf(L"  %zu hits, %d rocks left\n", hits, rocks.count);
+	}
+
 private:
 	struct Entity
 	{
@@ -23,16 +127,109 @@ private:
 		float angle;
 	};
 
-	struct Vector2
+	// everything else that moves, as parallel arrays so moving and wrapping
+	// them is a straight SSE walk down each array. The arrays only ever
+	// grow, count is how many are live. Removing moves the last entity into
+	// the hole, so order isn't kept
+	struct EntityStore
 	{
-		Vector2() = default;
-		Vector2(float x, float y)
-			:
-			x{ x }, y{ y }
-		{}
+		std::vector<int> size;
+		std::vector<float> x;
+		std::vector<float> y;
+		std::vector<float> xv;
+		std::vector<float> yv;
+		std::vector<float> angle;
+		int count{};
+
+		void Reserve(int capacity)
+		{
+			if (capacity <= (int)x.size())
+				return;
+
+			size.resize(capacity);
+			x.resize(capacity);
+			y.resize(capacity);
+			xv.resize(capacity);
+			yv.resize(capacity);
+			angle.resize(capacity);
+		}
 
-		float x;
-		float y;
+		void Clear()
+		{
+			count = 0;
+		}
+
+		int Add(int s, float px, float py, float vx, float vy, float a)
+		{
+			if (count == (int)x.size())
+				Reserve(max(64, count * 2));
+
+			size[count] = s;
+			x[count] = px;
+			y[count] = py;
+			xv[count] = vx;
+			yv[count] = vy;
+			angle[count] = a;
+			return count++;
+		}
+
+		void Remove(int i)
+		{
+			--count;
+			size[i] = size[count];
+			x[i] = x[count];
+			y[i] = y[count];
+			xv[i] = xv[count];
+			yv[i] = yv[count];
+			angle[i] = angle[count];
+		}
+
+		// position by velocity, angle by a spin shared by the whole store
+		void Integrate(float deltaTime, float spin)
+		{
+			const float turn = spin * deltaTime;
+			const __m128 step = _mm_set1_ps(deltaTime);
+			const __m128 turn4 = _mm_set1_ps(turn);
+			int i = 0;
+			for (; i + 4 <= count; i += 4)
+			{
+				_mm_storeu_ps(&x[i], _mm_add_ps(_mm_loadu_ps(&x[i]), _mm_mul_ps(_mm_loadu_ps(&xv[i]), step)));
+				_mm_storeu_ps(&y[i], _mm_add_ps(_mm_loadu_ps(&y[i]), _mm_mul_ps(_mm_loadu_ps(&yv[i]), step)));
+				_mm_storeu_ps(&angle[i], _mm_add_ps(_mm_loadu_ps(&angle[i]), turn4));
+			}
+			for (; i < count; ++i)
+			{
+				x[i] += xv[i] * deltaTime;
+				y[i] += yv[i] * deltaTime;
+				angle[i] += turn;
+			}
+		}
+
+		// same as WrapCoordinates, one field width at most
+		void Wrap(float width, float height)
+		{
+			int i = 0;
+			for (; i + 4 <= count; i += 4)
+			{
+				_mm_storeu_ps(&x[i], Wrap4(_mm_loadu_ps(&x[i]), width));
+				_mm_storeu_ps(&y[i], Wrap4(_mm_loadu_ps(&y[i]), height));
+			}
+			for (; i < count; ++i)
+			{
+				if (x[i] < 0.0f)		x[i] += width;
+				else if (x[i] >= width)	x[i] -= width;
+				if (y[i] < 0.0f)		y[i] += height;
+				else if (y[i] >= height)	y[i] -= height;
+			}
+		}
+
+		static __m128 Wrap4(__m128 v, float extent)
+		{
+			const __m128 e = _mm_set1_ps(extent);
+			__m128 under = _mm_and_ps(_mm_cmplt_ps(v, _mm_setzero_ps()), e);
+			__m128 over = _mm_and_ps(_mm_cmpge_ps(v, e), e);
+			return _mm_sub_ps(_mm_add_ps(v, under), over);
+		}
 	};
 
 	Entity ship;
@@ -40,11 +237,40 @@ private:
 	const float acceleration = 20.0f;
 	bool dead = false;
 	int score = 0;
-	std::vector<Entity> rock;
-	std::vector<Entity> bullets;
+	EntityStore rocks;
+	EntityStore bullets;
+	ParticleSystem particles;
+	float thrustTime = 0.0f; // exhaust owed but not emitted yet
 
 	std::vector<Vector2> shipModel;
 	std::vector<Vector2> rockModel;
+	float rockModelRadius{ 1.0f }; // furthest outline point, in model units
+
+	// rocks bucketed by cell, rebuilt every frame. The field is cut into
+	// whole cells at least as wide as the biggest rock's reach, so anything touching
+	// a rock is in its cell or one of the 8 around it, wrapping at the edges.
+	// cellStart[c] .. cellStart[c + 1] indexes cellRocks
+	int gridCols{ 1 };
+	int gridRows{ 1 };
+	float cellWidth{ 1.0f };
+	float cellHeight{ 1.0f };
+	std::vector<int> cellStart;
+	std::vector<int> cellRocks;
+	std::vector<int> rockCell;
+
+	// each rock's cos and sin with its size folded in, redone by Integrate
+	// and shared by DrawRocks and the collision narrowphase
+	std::vector<float> rockCos;
+	std::vector<float> rockSin;
+
+	// DrawRocks scratch, kept so drawing allocates nothing once warmed up.
+	// Points are vertex major, rockPointX[k * rocks.count + i] is vertex k
+	// of rock i
+	std::vector<int> rockPointX;
+	std::vector<int> rockPointY;
+
+	// rocks Collide hit this frame and the size each had, for Fragment
+	std::vector<std::pair<int, int>> rockHits;
 
 protected:
 	virtual bool OnAwake() override
@@ -63,9 +289,15 @@ protected:
 			float noise = (float)rand() / (float)RAND_MAX * 0.4f + 0.8f;
 			float randomX = noise * sinf(((float)i / (float)vertices) * 6.28318f);
 			float randomY = noise * cosf(((float)i / (float)vertices) * 6.28318f);
-			rockModel.push_back(Vector2(randomX, randomY));
+			rockModel.push_back({ randomX, randomY });
+			rockModelRadius = max(rockModelRadius, Vector2_Length(rockModel.back()));
 		}
 
+		// enough that a normal game never grows them
+		rocks.Reserve(256);
+		bullets.Reserve(256);
+		particles.Reserve(4096);
+
 		ResetGame();
 
 		return true;
@@ -76,9 +308,6 @@ protected:
 		if (dead)
 			ResetGame();
 
-		// clear screen
-		Fill(0, 0, GetScreenWidth(), GetScreenHeight(), Solid, BG_Black);
-
 		// ship control
 		if (keys[VK_LEFT].Hold)
 			ship.angle -= speed * deltaTime;
@@ -88,6 +317,7 @@ protected:
 		{
 			ship.xv += sin(ship.angle) * acceleration * deltaTime;
 			ship.yv += -cos(ship.angle) * acceleration * deltaTime;
+			Exhaust(deltaTime);
 		}
 
 		// ship pos
@@ -97,125 +327,161 @@ protected:
 		// check map boundary
 		WrapCoordinates(ship.x, ship.y, ship.x, ship.y);
 
-		// check ship collision
-		for (auto& r : rock)
-			if (IsPointInsideCircle(ship.x, ship.y, r.x, r.y, r.size))
-				dead = true;
-
 		// fire
 		if (keys[VK_SPACE].Release)
-			bullets.push_back({ 0, ship.x, ship.y, 50.0f * sinf(ship.angle),
-				-50.0f * cosf(ship.angle), 100.0f });
+			bullets.Add(0, ship.x, ship.y, 50.0f * sinf(ship.angle),
+				-50.0f * cosf(ship.angle), 100.0f);
 
-		// draw rock
-		for (auto& r : rock)
-		{
-			r.x += r.xv * deltaTime;
-			r.y += r.yv * deltaTime;
-			r.angle += 0.5f * deltaTime; // wiggle wiggle
+		Integrate(deltaTime);
+		DrawRocksStage();
+		Collide();
+		Fragment();
+		UpdateEffects(deltaTime);
+		DrawEffects();
+		DrawOverlay();
 
-			WrapCoordinates(r.x, r.y, r.x, r.y);
+		return true;
+	}
 
-			DrawWireFrame(rockModel, r.x, r.y, r.angle, (float)r.size, FG_Cyan);
-		}
+	// the frame in stages, split so the benchmark can time each one
 
+	void Integrate(float deltaTime)
+	{
+		const float width = (float)GetScreenWidth();
+		const float height = (float)GetScreenHeight();
 
-		std::vector<Entity> collapsedRock;
+		rocks.Integrate(deltaTime, 0.5f); // wiggle wiggle
+		rocks.Wrap(width, height);
+		UpdateRockTransforms();
+		bullets.Integrate(deltaTime, -1.0f);
+		bullets.Wrap(width, height);
+	}
 
-		for (auto& b : bullets)
-		{
-			b.x += b.xv * deltaTime;
-			b.y += b.yv * deltaTime;
-			WrapCoordinates(b.x, b.y, b.x, b.y);
-			b.angle -= 1.0f * deltaTime;
+	void DrawRocksStage()
+	{
+		// clear screen
+		Fill(0, 0, GetScreenWidth(), GetScreenHeight(), Solid, BG_Black);
+
+		DrawRocks(FG_Cyan);
+	}
+
+	// a hit rock gets size 0, which nothing can be inside, and stays where
+	// the grid has it until Fragment sweeps it out. Hits are kept in bullet
+	// order with the size the rock had
+	void Collide()
+	{
+		const float width = (float)GetScreenWidth();
+		const float height = (float)GetScreenHeight();
 
-			for (auto& r : rock)
+		BuildRockGrid();
+
+		// check ship collision
+		if (FirstRockHit(ship.x, ship.y) >= 0)
+			dead = true;
+
+		rockHits.clear();
+		for (int b = 0; b < bullets.count;)
+		{
+			float bx = bullets.x[b];
+			float by = bullets.y[b];
+			int hit = FirstRockHit(bx, by);
+			if (hit >= 0)
 			{
-				if (IsPointInsideCircle(b.x, b.y, r.x, r.y, r.size))
-				{
-					b.x = -100.0f;
-
-					// collapse
-					if (r.size > 4)
-					{
-						float angle1 = ((float)rand() / (float)RAND_MAX) * 6.283185f;
-						float angle2 = ((float)rand() / (float)RAND_MAX) * 6.283185f;
-						collapsedRock.push_back({ (int)r.size >> 1 , r.x, r.y, 10.0f * sinf(angle1), 10.0f * cosf(angle1), 0.0f });
-						collapsedRock.push_back({ (int)r.size >> 1 , r.x, r.y, 10.0f * sinf(angle2), 10.0f * cosf(angle2), 0.0f });
-					}
-
-					r.x = -100.0f;
-					score += 100;
-				}
+				rockHits.push_back({ hit, rocks.size[hit] });
+				rocks.size[hit] = 0;
+				score += 100;
 			}
+
+			// spent, or gone off the edge of the screen
+			if (hit >= 0 || bx < 1 || by < 1 || bx >= width - 1 || by >= height - 1)
+				bullets.Remove(b);
+			else
+				++b;
 		}
+	}
 
-		for (auto& cr : collapsedRock)
+	void Fragment()
+	{
+		for (auto& hit : rockHits)
 		{
-			rock.push_back(cr);
+			// debris, more for the bigger ones
+			particles.Emit(hit.second * 6, rocks.x[hit.first], rocks.y[hit.first],
+				rocks.xv[hit.first], rocks.yv[hit.first], 0.0f, 6.283185f, 2.0f * hit.second + 10.0f, 1.0f, FG_Grey);
+
+			// collapse
+			if (hit.second > 4)
+			{
+				float rx = rocks.x[hit.first];
+				float ry = rocks.y[hit.first];
+				float angle1 = ((float)rand() / (float)RAND_MAX) * 6.283185f;
+				float angle2 = ((float)rand() / (float)RAND_MAX) * 6.283185f;
+				rocks.Add(hit.second >> 1, rx, ry, 10.0f * sinf(angle1), 10.0f * cosf(angle1), 0.0f);
+				rocks.Add(hit.second >> 1, rx, ry, 10.0f * sinf(angle2), 10.0f * cosf(angle2), 0.0f);
+			}
 		}
 
-		if (rock.size() > 0)
+		for (int i = 0; i < rocks.count;)
 		{
-			auto i = std::remove_if(rock.begin(), rock.end(),
-				[&](Entity e) {return (e.x < 0); });
-
-			if (i != rock.end())
-				rock.erase(i);
+			if (rocks.size[i] == 0)
+				rocks.Remove(i);
+			else
+				++i;
 		}
 
-		if (rock.empty()) // next level
+		if (rocks.count == 0) // next level
 		{
-			rock.clear();
-			bullets.clear();
+			bullets.Clear();
 
 			// make sure don't spawn in ship's nearby
-			rock.push_back(
-				{
-					(int)16, 30.0f * sinf(ship.angle - 3.14159f / 2.0f) + ship.x,
-					30.0f * cosf(ship.angle - 3.14159f / 2.0f) + ship.y,
-					10.0f * sinf(ship.angle), 10.0f * cosf(ship.angle), 0.0f
-				}
-			);
+			rocks.Add(16, 30.0f * sinf(ship.angle - 3.14159f / 2.0f) + ship.x,
+				30.0f * cosf(ship.angle - 3.14159f / 2.0f) + ship.y,
+				10.0f * sinf(ship.angle), 10.0f * cosf(ship.angle), 0.0f);
 
-			rock.push_back(
-				{
-					(int)16, 30.0f * sinf(ship.angle - 3.14159f / 2.0f) + ship.x,
-					30.0f * cosf(ship.angle + 3.14159f / 2.0f) + ship.y,
-					10.0f * sinf(-ship.angle), 10.0f * cosf(-ship.angle), 0.0f
-				}
-			);
+			rocks.Add(16, 30.0f * sinf(ship.angle - 3.14159f / 2.0f) + ship.x,
+				30.0f * cosf(ship.angle + 3.14159f / 2.0f) + ship.y,
+				10.0f * sinf(-ship.angle), 10.0f * cosf(-ship.angle), 0.0f);
 		}
+	}
 
-		// remove offscreen bullets
-		if (bullets.size() > 0)
-		{
-			auto i = std::remove_if(bullets.begin(), bullets.end(),
-				[&](Entity e)
-				{
-					return (
-						e.x < 1 || e.y < 1 ||
-						e.x >= GetScreenWidth() - 1 ||
-						e.y >= GetScreenHeight() - 1);
-				}
-			);
+	void UpdateEffects(float deltaTime)
+	{
+		particles.Integrate(deltaTime);
+		particles.Wrap((float)GetScreenWidth(), (float)GetScreenHeight());
+	}
 
-			if (i != bullets.end())
-				bullets.erase(i);
-		}
+	void DrawEffects()
+	{
+		DrawParticles(particles);
+	}
 
+	void DrawOverlay()
+	{
 		// draw bullets
-		for (auto& b : bullets)
-			Draw(b.x, b.y);
+		for (int b = 0; b < bullets.count; ++b)
+			Draw(bullets.x[b], bullets.y[b]);
 
 		// draw ship
-		DrawWireFrame(shipModel, ship.x, ship.y, ship.angle);
+		DrawWireFrame(shipModel, ship.x, ship.y, ship.angle, 1.0f, FG_White, Solid, true);
 
 		// draw score
 		score += 1000;
 		DrawString(2, 2, L"Score: " + std::to_wstring(score));
+	}
 
-		return true;
+	// sparks out of the back of the ship at a steady rate, however fast the
+	// frames come
+	void Exhaust(float deltaTime)
+	{
+		const float rate = 120.0f;
+		thrustTime += deltaTime;
+		int n = (int)(thrustTime * rate);
+		if (n == 0)
+			return;
+		thrustTime -= n / rate;
+
+		Vector2 tail = Vector2_Rotate({ 0.0f, 2.5f }, cosf(ship.angle), sinf(ship.angle));
+		particles.Emit(n, ship.x + tail.x, ship.y + tail.y, ship.xv, ship.yv,
+			ship.angle + 1.570796f, 0.5f, 25.0f, 0.4f, FG_Yellow);
 	}
 
 	void ResetGame()
@@ -226,11 +492,11 @@ protected:
 		ship.yv = 0.0f;
 		ship.angle = 0.0f;
 
-		rock.clear();
-		bullets.clear();
+		rocks.Clear();
+		bullets.Clear();
 
-		rock.push_back({ (int)16, 20.0f, 20.0f, 8.0f, -6.0f, 0.0f });
-		rock.push_back({ (int)16, 100.0f, 20.0f, -5.0f, 3.0f, 0.0f });
+		rocks.Add(16, 20.0f, 20.0f, 8.0f, -6.0f, 0.0f);
+		rocks.Add(16, 100.0f, 20.0f, -5.0f, 3.0f, 0.0f);
 
 		dead = false;
 		score = 0;
@@ -249,57 +515,201 @@ protected:
 		if (iy >= height)	oy = iy - height;
 	}
 
-	virtual void Draw(int x, int y, short cha = 0x2588, short col = 0x000F) override
+	// p - c the short way round the wrapped field
+	Vector2 WrappedDelta(float px, float py, float cx, float cy)
 	{
-		float ox{};
-		float oy{};
-		WrapCoordinates(x, y, ox, oy);
-		Console69::Draw(ox, oy, cha, col);
+		const float width = (float)GetScreenWidth();
+		const float height = (float)GetScreenHeight();
+		float dx = px - cx;
+		float dy = py - cy;
+		if (dx > 0.5f * width)		dx -= width;
+		if (dx < -0.5f * width)		dx += width;
+		if (dy > 0.5f * height)		dy -= height;
+		if (dy < -0.5f * height)	dy += height;
+		return { dx, dy };
 	}
 
-	bool IsPointInsideCircle(float px, float py, float cx, float cy, float r)
+	// the bounding circle rejects most points with a squared distance. The
+	// few left are taken back into model space with the rock's cached cos
+	// and sin, which carry the size, so dividing by size squared undoes
+	// both, and tested against the outline itself
+	bool IsPointInsideRock(float px, float py, int i)
 	{
-		const float distance = sqrt((px - cx) * (px - cx) + (py - cy) * (py - cy));
-		return distance < r;
+		const float size = (float)rocks.size[i];
+		const float reach = size * rockModelRadius;
+		Vector2 d = WrappedDelta(px, py, rocks.x[i], rocks.y[i]);
+		if (Vector2_DotProduct(d, d) >= reach * reach)
+			return false;
+
+		const float c = rockCos[i];
+		const float s = rockSin[i];
+		const float inverse = 1.0f / (size * size);
+		Vector2 local{ (c * d.x + s * d.y) * inverse, (c * d.y - s * d.x) * inverse };
+		return IsPointInsidePolygon(rockModel, local);
 	}
 
-	void DrawWireFrame(const std::vector<Vector2>& model, float x, float y, float r = 0.0f, float s = 1.0f, short col = FG_White)
+	// even-odd, count the edges a ray to the right of the point crosses
+	static bool IsPointInsidePolygon(const std::vector<Vector2>& polygon, const Vector2& p)
 	{
-		std::vector<Vector2> transformed;
-		const int vertices = model.size();
-		transformed.resize(vertices);
+		bool inside = false;
+		for (size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++)
+		{
+			const Vector2& a = polygon[i];
+			const Vector2& b = polygon[j];
+			if ((a.y > p.y) != (b.y > p.y) && p.x < (b.x - a.x) * (p.y - a.y) / (b.y - a.y) + a.x)
+				inside = !inside;
+		}
+		return inside;
+	}
 
-		// rotate
-		for (int i = 0; i < vertices; ++i)
+	void UpdateRockTransforms()
+	{
+		if ((int)rockCos.size() < rocks.count)
 		{
-			transformed[i].x = model[i].x * cosf(r) - model[i].y * sinf(r);
-			transformed[i].y = model[i].x * sinf(r) + model[i].y * cosf(r);
+			rockCos.resize(rocks.count);
+			rockSin.resize(rocks.count);
 		}
 
-		// scale
-		for (int i = 0; i < vertices; ++i)
+		// scale folded in like DrawWireFrame does
+		for (int i = 0; i < rocks.count; ++i)
 		{
-			transformed[i].x = transformed[i].x * s;
-			transformed[i].y = transformed[i].y * s;
+			rockCos[i] = cosf(rocks.angle[i]) * (float)rocks.size[i];
+			rockSin[i] = sinf(rocks.angle[i]) * (float)rocks.size[i];
 		}
+	}
 
-		// translate
-		for (int i = 0; i < vertices; ++i)
+	// every rock is the same model, so instead of a DrawWireFrame each the
+	// whole lot goes through at once. One vertex of the model at a time is
+	// placed for four rocks per SSE step, then the outlines are drawn from
+	// the finished points. Same arithmetic as DrawWireFrame, same pixels
+	void DrawRocks(short col)
+	{
+		const int count = rocks.count;
+		const int vertices = (int)rockModel.size();
+		if (count == 0 || vertices == 0)
+			return;
+
+		if ((int)rockPointX.size() < count * vertices)
 		{
-			transformed[i].x = transformed[i].x + x;
-			transformed[i].y = transformed[i].y + y;
+			rockPointX.resize(count * vertices);
+			rockPointY.resize(count * vertices);
 		}
 
-		for (int i = 0; i < vertices; ++i)
+		for (int k = 0; k < vertices; ++k)
+		{
+			const float mx = rockModel[k].x;
+			const float my = rockModel[k].y;
+			const __m128 mx4 = _mm_set1_ps(mx);
+			const __m128 my4 = _mm_set1_ps(my);
+			int* outX = &rockPointX[k * count];
+			int* outY = &rockPointY[k * count];
+
+			int i = 0;
+			for (; i + 4 <= count; i += 4)
+			{
+				__m128 c = _mm_loadu_ps(&rockCos[i]);
+				__m128 s = _mm_loadu_ps(&rockSin[i]);
+				__m128 px = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(mx4, c), _mm_mul_ps(my4, s)), _mm_loadu_ps(&rocks.x[i]));
+				__m128 py = _mm_add_ps(_mm_add_ps(_mm_mul_ps(mx4, s), _mm_mul_ps(my4, c)), _mm_loadu_ps(&rocks.y[i]));
+				_mm_storeu_si128((__m128i*)&outX[i], _mm_cvttps_epi32(px));
+				_mm_storeu_si128((__m128i*)&outY[i], _mm_cvttps_epi32(py));
+			}
+			for (; i < count; ++i)
+			{
+				Vector2 p = Vector2_Add(Vector2_Rotate(rockModel[k], rockCos[i], rockSin[i]), { rocks.x[i], rocks.y[i] });
+				outX[i] = (int)p.x;
+				outY[i] = (int)p.y;
+			}
+		}
+
+		for (int i = 0; i < count; ++i)
 		{
-			int j = i + 1;
-			DrawLine(
-				transformed[i % vertices].x,
-				transformed[i % vertices].y,
-				transformed[j % vertices].x,
-				transformed[j % vertices].y,
-				Solid, col
-			);
+			for (int k = 0; k < vertices; ++k)
+			{
+				int a = k * count + i;
+				int b = (k + 1 < vertices ? k + 1 : 0) * count + i;
+				DrawLineWrapped(rockPointX[a], rockPointY[a], rockPointX[b], rockPointY[b], Solid, col);
+			}
+		}
+	}
+
+	int CellOf(float x, float y) const
+	{
+		int cx = max(0, min(gridCols - 1, (int)(x / cellWidth)));
+		int cy = max(0, min(gridRows - 1, (int)(y / cellHeight)));
+		return cx + cy * gridCols;
+	}
+
+	// counting sort of the live rocks into their cells
+	void BuildRockGrid()
+	{
+		int biggest = 1;
+		for (int i = 0; i < rocks.count; ++i)
+			biggest = max(biggest, rocks.size[i]);
+		const float reach = biggest * rockModelRadius;
+
+		const float width = (float)GetScreenWidth();
+		const float height = (float)GetScreenHeight();
+		gridCols = max(1, (int)(width / reach));
+		gridRows = max(1, (int)(height / reach));
+		cellWidth = width / gridCols;
+		cellHeight = height / gridRows;
+
+		cellStart.assign(gridCols * gridRows + 1, 0);
+		rockCell.resize(rocks.count);
+		for (int i = 0; i < rocks.count; ++i)
+		{
+			rockCell[i] = rocks.size[i] <= 0 ? -1 : CellOf(rocks.x[i], rocks.y[i]);
+			if (rockCell[i] >= 0)
+				++cellStart[rockCell[i] + 1];
+		}
+
+		for (size_t c = 1; c < cellStart.size(); ++c)
+			cellStart[c] += cellStart[c - 1];
+
+		// rocks go in by index so each cell lists them in order
+		cellRocks.resize(cellStart.back());
+		for (int i = 0; i < rocks.count; ++i)
+			if (rockCell[i] >= 0)
+				cellRocks[cellStart[rockCell[i]]++] = i;
+
+		// the fill walked every start one cell on, step them back
+		for (size_t c = cellStart.size() - 1; c > 0; --c)
+			cellStart[c] = cellStart[c - 1];
+		cellStart[0] = 0;
+	}
+
+	// lowest index live rock covering the point, so the pick doesn't depend
+	// on how the grid happens to be walked. -1 when there is none
+	int FirstRockHit(float x, float y)
+	{
+		const int home = CellOf(x, y);
+		const int hx = home % gridCols;
+		const int hy = home / gridCols;
+
+		// a field only one or two cells across has fewer distinct neighbours
+		const int spanX = min(3, gridCols);
+		const int spanY = min(3, gridRows);
+
+		int first = -1;
+		for (int oy = 0; oy < spanY; ++oy)
+		{
+			int cy = (hy + oy - (spanY == 3 ? 1 : 0) + gridRows) % gridRows;
+			for (int ox = 0; ox < spanX; ++ox)
+			{
+				int cx = (hx + ox - (spanX == 3 ? 1 : 0) + gridCols) % gridCols;
+				int c = cx + cy * gridCols;
+				for (int k = cellStart[c]; k < cellStart[c + 1]; ++k)
+				{
+					int i = cellRocks[k];
+					if (first >= 0 && i > first)
+						break;
+
+					if (IsPointInsideRock(x, y, i))
+						first = i;
+				}
+			}
 		}
+		return first;
 	}
 };
\ No newline at end of file
@@ -0,0 +1,272 @@
+#pragma once
+#include <emmintrin.h>
+
+#include <cmath>
+#include <cstddef>
+
+// math shared by every demo. Plain value types, everything that is only
+// arithmetic is constexpr so constant setups fold away, and the per vertex
+// paths ( matrix * vector, matrix * matrix and the batch version ) run 4
+// wide on SSE. The SSE sums are done in the same order as the scalar ones
+// so results match bit for bit
+
+struct Vector2
+{
+	float x{};
+	float y{};
+};
+
+// w rides along so a Vector3 is one SSE register and points transform
+// with the translation row, directions set w to 0
+struct Vector3
+{
+	float x{};
+	float y{};
+	float z{};
+	float w{ 1 };
+};
+
+// row vectors, v * M, so the translation sits in the last row
+struct Matrix
+{
+	float v[4][4]{};
+};
+
+static_assert(sizeof(Vector3) == 4 * sizeof(float), "Vector3 loads as one __m128");
+static_assert(sizeof(Matrix) == 16 * sizeof(float), "Matrix rows load as __m128");
+
+constexpr Vector2 Vector2_Add(const Vector2& v1, const Vector2& v2)
+{
+	return { v1.x + v2.x, v1.y + v2.y };
+}
+
+constexpr Vector2 Vector2_Sub(const Vector2& v1, const Vector2& v2)
+{
+	return { v1.x - v2.x, v1.y - v2.y };
+}
+
+constexpr Vector2 Vector2_Mul(const Vector2& v1, float scale)
+{
+	return { v1.x * scale, v1.y * scale };
+}
+
+constexpr float Vector2_DotProduct(const Vector2& v1, const Vector2& v2)
+{
+	return v1.x * v2.x + v1.y * v2.y;
+}
+
+// z of the 3D cross product, positive when v2 is clockwise of v1 on screen
+constexpr float Vector2_CrossProduct(const Vector2& v1, const Vector2& v2)
+{
+	return v1.x * v2.y - v1.y * v2.x;
+}
+
+inline float Vector2_Length(const Vector2& v)
+{
+	return sqrtf(Vector2_DotProduct(v, v));
+}
+
+// the angle's cos and sin come in so one pair serves a whole model
+constexpr Vector2 Vector2_Rotate(const Vector2& v, float cosR, float sinR)
+{
+	return { v.x * cosR - v.y * sinR, v.x * sinR + v.y * cosR };
+}
+
+constexpr Vector3 Vector3_Add(const Vector3& v1, const Vector3& v2)
+{
+	return { v1.x + v2.x, v1.y + v2.y, v1.z + v2.z };
+}
+
+constexpr Vector3 Vector3_Sub(const Vector3& v1, const Vector3& v2)
+{
+	return { v1.x - v2.x, v1.y - v2.y, v1.z - v2.z };
+}
+
+constexpr Vector3 Vector3_Mul(const Vector3& v1, float scale)
+{
+	return { v1.x * scale, v1.y * scale, v1.z * scale };
+}
+
+constexpr Vector3 Vector3_Div(const Vector3& v1, float scale)
+{
+	return { v1.x / scale, v1.y / scale, v1.z / scale };
+}
+
+constexpr float Vector3_DotProduct(const Vector3& v1, const Vector3& v2)
+{
+	return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
+}
+
+inline float Vector3_Length(const Vector3& v)
+{
+	return sqrtf(Vector3_DotProduct(v, v));
+}
+
+inline Vector3 Vector3_Normalize(const Vector3& v)
+{
+	float l = Vector3_Length(v);
+	return { v.x / l, v.y / l, v.z / l };
+}
+
+constexpr Vector3 Vector3_CrossProduct(const Vector3& v1, const Vector3& v2)
+{
+	return {
+		v1.y * v2.z - v1.z * v2.y,
+		v1.z * v2.x - v1.x * v2.z,
+		v1.x * v2.y - v1.y * v2.x
+	};
+}
+
+constexpr Vector3 Vector3_Lerp(const Vector3& v1, const Vector3& v2, float t)
+{
+	return {
+		v1.x + (v2.x - v1.x) * t,
+		v1.y + (v2.y - v1.y) * t,
+		v1.z + (v2.z - v1.z) * t,
+		v1.w + (v2.w - v1.w) * t
+	};
+}
+
+// x * row0 + y * row1 + z * row2 + w * row3, the rows already in registers
+inline __m128 Matrix_MultiplyRows(const __m128* rows, const Vector3& i)
+{
+	__m128 r = _mm_mul_ps(_mm_set1_ps(i.x), rows[0]);
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(i.y), rows[1]));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(i.z), rows[2]));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(i.w), rows[3]));
+	return r;
+}
+
+inline Vector3 Matrix_MultiplyVector(const Matrix& m, const Vector3& i)
+{
+	const __m128 rows[4] = { _mm_loadu_ps(m.v[0]), _mm_loadu_ps(m.v[1]), _mm_loadu_ps(m.v[2]), _mm_loadu_ps(m.v[3]) };
+	Vector3 v;
+	_mm_storeu_ps(&v.x, Matrix_MultiplyRows(rows, i));
+	return v;
+}
+
+// count points through the same matrix, the rows are loaded once. in and
+// out may be the same array
+inline void Matrix_MultiplyVectors(const Matrix& m, const Vector3* in, Vector3* out, size_t count)
+{
+	const __m128 rows[4] = { _mm_loadu_ps(m.v[0]), _mm_loadu_ps(m.v[1]), _mm_loadu_ps(m.v[2]), _mm_loadu_ps(m.v[3]) };
+	for (size_t n = 0; n < count; ++n)
+		_mm_storeu_ps(&out[n].x, Matrix_MultiplyRows(rows, in[n]));
+}
+
+// every row of m1 is a point through m2
+inline Matrix Matrix_MultiplyMatrix(const Matrix& m1, const Matrix& m2)
+{
+	const __m128 rows[4] = { _mm_loadu_ps(m2.v[0]), _mm_loadu_ps(m2.v[1]), _mm_loadu_ps(m2.v[2]), _mm_loadu_ps(m2.v[3]) };
+	Matrix matrix;
+	for (int r = 0; r < 4; ++r)
+		_mm_storeu_ps(matrix.v[r], Matrix_MultiplyRows(rows, { m1.v[r][0], m1.v[r][1], m1.v[r][2], m1.v[r][3] }));
+	return matrix;
+}
+
+constexpr Matrix Matrix_GetIdentity()
+{
+	Matrix identity{};
+	identity.v[0][0] = 1.0f;
+	identity.v[1][1] = 1.0f;
+	identity.v[2][2] = 1.0f;
+	identity.v[3][3] = 1.0f;
+	return identity;
+}
+
+constexpr Matrix Matrix_GetTranslation(float x, float y, float z)
+{
+	Matrix translation = Matrix_GetIdentity();
+	translation.v[3][0] = x;
+	translation.v[3][1] = y;
+	translation.v[3][2] = z;
+	return translation;
+}
+
+inline Matrix Matrix_GetRotationX(float rad)
+{
+	const float c = cosf(rad), s = sinf(rad);
+	Matrix rotationX;
+	rotationX.v[0][0] = 1.0f;
+	rotationX.v[1][1] = c;
+	rotationX.v[1][2] = s;
+	rotationX.v[2][1] = -s;
+	rotationX.v[2][2] = c;
+	rotationX.v[3][3] = 1.0f;
+	return rotationX;
+}
+
+inline Matrix Matrix_GetRotationY(float rad)
+{
+	const float c = cosf(rad), s = sinf(rad);
+	Matrix rotationY;
+	rotationY.v[0][0] = c;
+	rotationY.v[0][2] = s;
+	rotationY.v[2][0] = -s;
+	rotationY.v[1][1] = 1.0f;
+	rotationY.v[2][2] = c;
+	rotationY.v[3][3] = 1.0f;
+	return rotationY;
+}
+
+inline Matrix Matrix_GetRotationZ(float rad)
+{
+	const float c = cosf(rad), s = sinf(rad);
+	Matrix rotationZ;
+	rotationZ.v[0][0] = c;
+	rotationZ.v[0][1] = s;
+	rotationZ.v[1][0] = -s;
+	rotationZ.v[1][1] = c;
+	rotationZ.v[2][2] = 1.0f;
+	rotationZ.v[3][3] = 1.0f;
+	return rotationZ;
+}
+
+inline Matrix Matrix_GetProjection(float fov, float ratio, float eyeNear, float eyeFar)
+{
+	float fFovRad = 1.0f / tanf(fov * 0.5f / 180.0f * 3.14159f);
+	Matrix projection;
+	projection.v[0][0] = ratio * fFovRad;
+	projection.v[1][1] = fFovRad;
+	projection.v[2][2] = eyeFar / (eyeFar - eyeNear);
+	projection.v[3][2] = (-eyeFar * eyeNear) / (eyeFar - eyeNear);
+	projection.v[2][3] = 1.0f;
+	projection.v[3][3] = 0.0f;
+	return projection;
+}
+
+inline Matrix Matrix_PointAt(const Vector3& pos, const Vector3& target, const Vector3& up)
+{
+	// calculate new forward direction
+	Vector3 newForward = Vector3_Normalize(Vector3_Sub(target, pos));
+
+	// calculate new Up direction
+	Vector3 a = Vector3_Mul(newForward, Vector3_DotProduct(up, newForward));
+	Vector3 newUp = Vector3_Normalize(Vector3_Sub(up, a));
+
+	// new Right direction is easy, its just cross product
+	Vector3 newRight = Vector3_CrossProduct(newUp, newForward);
+
+	// construct Dimensioning and Translation Matrix
+	Matrix matrix;
+	matrix.v[0][0] = newRight.x;	matrix.v[0][1] = newRight.y;	matrix.v[0][2] = newRight.z;	matrix.v[0][3] = 0.0f;
+	matrix.v[1][0] = newUp.x;		matrix.v[1][1] = newUp.y;		matrix.v[1][2] = newUp.z;		matrix.v[1][3] = 0.0f;
+	matrix.v[2][0] = newForward.x;	matrix.v[2][1] = newForward.y;	matrix.v[2][2] = newForward.z;	matrix.v[2][3] = 0.0f;
+	matrix.v[3][0] = pos.x;			matrix.v[3][1] = pos.y;			matrix.v[3][2] = pos.z;			matrix.v[3][3] = 1.0f;
+	return matrix;
+}
+
+// only for rotation + translation matrices, the rotation's transpose and
+// the translation taken back through it
+constexpr Matrix Matrix_QuickInverse(const Matrix& m)
+{
+	Matrix inverse{};
+	inverse.v[0][0] = m.v[0][0]; inverse.v[0][1] = m.v[1][0]; inverse.v[0][2] = m.v[2][0]; inverse.v[0][3] = 0.0f;
+	inverse.v[1][0] = m.v[0][1]; inverse.v[1][1] = m.v[1][1]; inverse.v[1][2] = m.v[2][1]; inverse.v[1][3] = 0.0f;
+	inverse.v[2][0] = m.v[0][2]; inverse.v[2][1] = m.v[1][2]; inverse.v[2][2] = m.v[2][2]; inverse.v[2][3] = 0.0f;
+	inverse.v[3][0] = -(m.v[3][0] * inverse.v[0][0] + m.v[3][1] * inverse.v[1][0] + m.v[3][2] * inverse.v[2][0]);
+	inverse.v[3][1] = -(m.v[3][0] * inverse.v[0][1] + m.v[3][1] * inverse.v[1][1] + m.v[3][2] * inverse.v[2][1]);
+	inverse.v[3][2] = -(m.v[3][0] * inverse.v[0][2] + m.v[3][1] * inverse.v[1][2] + m.v[3][2] * inverse.v[2][2]);
+	inverse.v[3][3] = 1.0f;
+	return inverse;
+}
@@ -3,6 +3,10 @@
 #include <fstream>
 #include <strstream>
 #include <algorithm>
+#include <cstdint>
+#include <queue>
+#include <memory>
+#include <cassert>
 
 class World : public Console69
 {
@@ -12,33 +16,291 @@ public:
 		appName = L"World";
 	}
 
-private:
-	struct Vector3
+	~World()
 	{
-		float x{};
-		float y{};
-		float z{};
-		float w{ 1 };
-	};
+		Terrain_StopLoader();
+	}
+
+	// crates to scatter over the terrain when it loads, all copies of one
+	// mesh. None by default, the demo is the terrain
+	void SetPropCount(int count)
+	{
+		propCount = max(0, count);
+	}
 
+private:
 	struct Triangle
 	{
 		Vector3 vertices[3];
-		wchar_t symbol;
-		short color;
+		float luminance[3]; // per corner, filled in on the way to the screen
 	};
 
-	struct Mesh
+	// a run of triangles with a bounding sphere and a cone around their
+	// normals, the run can be dropped at once when all of it faces away
+	struct MeshCluster
+	{
+		int first{};
+		int count{};
+		Vector3 center;
+		float radius{};
+		Vector3 axis;
+		float cutoff{ 1.0f }; // sine of the cone's spread, 1 means never cull
+	};
+
+	// luminance of every corner of a level for the object space light in
+	// light, only redone when the light turns relative to the owner or the
+	// owner switches level
+	struct ShadeCache
+	{
+		std::vector<float> luminance;
+		Vector3 light{ 0.0f, 0.0f, 0.0f, 0.0f };
+		int level{ -1 };
+	};
+
+	// one step of the detail chain, error is how far (in object space) the
+	// simplified surface may stray from the original. Normals are per
+	// triangle and in object space, they never change after loading
+	struct MeshLevel
 	{
 		std::vector<Triangle> triangles;
+		std::vector<Vector3> normals;
+		std::vector<MeshCluster> clusters;
+		float error{};
+
+		// three per triangle, what the corners get lit with
+		std::vector<Vector3> cornerNormals;
+
+		// for a level with a single owner, the terrain tiles
+		ShadeCache shade;
+
+		// octahedral map of the normal cut into a 4x4 grid, faces in the same
+		// cell point within a few tens of degrees of each other
+		static uint64_t FacingBucket(const Vector3& n)
+		{
+			float l = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+			if (l <= 0.0f)
+				return 0;
+
+			float u = n.x / l;
+			float v = n.z / l;
+			if (n.y < 0.0f)
+			{
+				float fu = (1.0f - fabsf(v)) * (u < 0.0f ? -1.0f : 1.0f);
+				float fv = (1.0f - fabsf(u)) * (v < 0.0f ? -1.0f : 1.0f);
+				u = fu;
+				v = fv;
+			}
+
+			int cu = min(3, (int)((u * 0.5f + 0.5f) * 4.0f));
+			int cv = min(3, (int)((v * 0.5f + 0.5f) * 4.0f));
+			return (uint64_t)(cu + cv * 4);
+		}
+
+		// regroup the triangles so each cluster is a contiguous run. Space is
+		// cut into an 8x8x8 grid of regions, faces in a region are split up
+		// by which way they roughly point and ordered along a Morton curve
+		void BuildClusters()
+		{
+			const int clusterSize = 32;
+			size_t count = triangles.size();
+
+			Vector3 lo = count ? triangles[0].vertices[0] : Vector3{};
+			Vector3 hi = lo;
+			for (auto& t : triangles)
+				for (auto& p : t.vertices)
+				{
+					lo = { min(lo.x, p.x), min(lo.y, p.y), min(lo.z, p.z) };
+					hi = { max(hi.x, p.x), max(hi.y, p.y), max(hi.z, p.z) };
+				}
+
+			auto spread = [](uint32_t v)
+			{
+				uint64_t x = v & 0x1FFFFF;
+				x = (x | x << 32) & 0x1F00000000FFFFull;
+				x = (x | x << 16) & 0x1F0000FF0000FFull;
+				x = (x | x << 8) & 0x100F00F00F00F00Full;
+				x = (x | x << 4) & 0x10C30C30C30C30C3ull;
+				x = (x | x << 2) & 0x1249249249249249ull;
+				return x;
+			};
+
+			auto quantize = [](float v, float lo, float hi)
+			{
+				return hi > lo ? (uint32_t)((v - lo) / (hi - lo) * 1023.0f) : 0u;
+			};
+
+			std::vector<std::pair<uint64_t, uint32_t>> order(count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				const Triangle& t = triangles[i];
+				Vector3 n = Mesh::FaceNormal(t.vertices[0], t.vertices[1], t.vertices[2]);
+				uint64_t facing = FacingBucket(n);
+
+				Vector3 c{
+					(t.vertices[0].x + t.vertices[1].x + t.vertices[2].x) / 3.0f,
+					(t.vertices[0].y + t.vertices[1].y + t.vertices[2].y) / 3.0f,
+					(t.vertices[0].z + t.vertices[1].z + t.vertices[2].z) / 3.0f
+				};
+				uint64_t morton = spread(quantize(c.x, lo.x, hi.x)) |
+					spread(quantize(c.y, lo.y, hi.y)) << 1 |
+					spread(quantize(c.z, lo.z, hi.z)) << 2;
+
+				// coarse region first so clusters stay small on screen, then
+				// facing, then the fine curve inside the region
+				uint64_t region = morton >> 21;
+				order[i] = { region << 36 | facing << 30 | morton, (uint32_t)i };
+			}
+			std::sort(order.begin(), order.end());
+
+			std::vector<Triangle> sorted(count);
+			std::vector<Vector3> sortedCorners(cornerNormals.size());
+			normals.resize(count);
+			for (size_t i = 0; i < count; ++i)
+			{
+				const Triangle& t = triangles[order[i].second];
+				sorted[i] = t;
+				if (!cornerNormals.empty())
+					for (int k = 0; k < 3; ++k)
+						sortedCorners[i * 3 + k] = cornerNormals[order[i].second * 3 + k];
+
+				Vector3 n = Mesh::FaceNormal(t.vertices[0], t.vertices[1], t.vertices[2]);
+				float length = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+				normals[i] = length > 0.0f ? Vector3{ n.x / length, n.y / length, n.z / length, 0.0f } : Vector3{ 0.0f, 0.0f, 0.0f, 0.0f };
+			}
+			triangles.swap(sorted);
+			cornerNormals.swap(sortedCorners);
+
+			clusters.clear();
+			for (size_t first = 0; first < count;)
+			{
+				size_t last = first + 1;
+				while (last < count && last - first < clusterSize && (order[last].first >> 30) == (order[first].first >> 30))
+					++last;
+
+				MeshCluster cluster;
+				cluster.first = (int)first;
+				cluster.count = (int)(last - first);
+
+				Vector3 clo = triangles[first].vertices[0];
+				Vector3 chi = clo;
+				Vector3 axis{ 0.0f, 0.0f, 0.0f, 0.0f };
+				for (size_t i = first; i < last; ++i)
+				{
+					for (auto& p : triangles[i].vertices)
+					{
+						clo = { min(clo.x, p.x), min(clo.y, p.y), min(clo.z, p.z) };
+						chi = { max(chi.x, p.x), max(chi.y, p.y), max(chi.z, p.z) };
+					}
+					axis = { axis.x + normals[i].x, axis.y + normals[i].y, axis.z + normals[i].z, 0.0f };
+				}
+
+				cluster.center = { 0.5f * (clo.x + chi.x), 0.5f * (clo.y + chi.y), 0.5f * (clo.z + chi.z) };
+				for (size_t i = first; i < last; ++i)
+					for (auto& p : triangles[i].vertices)
+					{
+						float dx = p.x - cluster.center.x, dy = p.y - cluster.center.y, dz = p.z - cluster.center.z;
+						cluster.radius = max(cluster.radius, sqrtf(dx * dx + dy * dy + dz * dz));
+					}
+
+				// the cone has to hold every normal, once it opens up past
+				// about 85 degrees nothing useful can be culled with it
+				float length = sqrtf(axis.x * axis.x + axis.y * axis.y + axis.z * axis.z);
+				if (length > 0.0f)
+				{
+					cluster.axis = { axis.x / length, axis.y / length, axis.z / length, 0.0f };
+					float minDot = 1.0f;
+					for (size_t i = first; i < last; ++i)
+						minDot = min(minDot, cluster.axis.x * normals[i].x + cluster.axis.y * normals[i].y + cluster.axis.z * normals[i].z);
+					if (minDot > 0.1f)
+						cluster.cutoff = sqrtf(1.0f - minDot * minDot);
+				}
+
+				clusters.push_back(cluster);
+				first = last;
+			}
+		}
+	};
+
+	struct Mesh
+	{
+		// levels[0] is the mesh as loaded, each next one has about half the triangles
+		std::vector<MeshLevel> levels;
+		Vector3 center;
+		float radius{};
 
 		bool LoadObjFile(const std::string& file)
+		{
+			std::vector<Vector3> positions;
+			std::vector<Vector3> normals;
+			std::vector<int> indices;
+			if (!ReadObjFile(file, positions, normals, indices))
+				return false;
+
+			BuildLevels(positions, indices, normals);
+			return true;
+		}
+
+		// the cube from the early days, size across and sitting on y = 0. Corner
+		// i is at x = i & 1, y = i & 2, z = i & 4
+		static Mesh MakeBox(float size)
+		{
+			std::vector<Vector3> positions;
+			for (int i = 0; i < 8; ++i)
+				positions.push_back({ (i & 1 ? 0.5f : -0.5f) * size, (i & 2 ? 1.0f : 0.0f) * size, (i & 4 ? 0.5f : -0.5f) * size });
+
+			std::vector<int> indices =
+			{
+				0, 2, 3,   0, 3, 1, // S
+				1, 3, 7,   1, 7, 5, // E
+				5, 7, 6,   5, 6, 4, // N
+				4, 6, 2,   4, 2, 0, // W
+				2, 6, 7,   2, 7, 3, // U
+				5, 4, 0,   5, 0, 1, // D
+			};
+
+			Mesh mesh;
+			mesh.BuildLevels(positions, indices);
+			return mesh;
+		}
+
+		// vertex positions, triangle corners and the normals if the file has
+		// any ( f v//vn or v/vt/vn ). Normals end up one per position, a
+		// position used with several normals keeps the last. Left empty when
+		// the file has none
+		static bool ReadObjFile(const std::string& file, std::vector<Vector3>& cache, std::vector<Vector3>& normals, std::vector<int>& indices)
+		{
+			std::vector<Vector3> fileNormals;
+			if (!ReadObjVertices(file, cache, fileNormals))
+				return false;
+
+			bool hasNormals = false;
+			std::vector<Vector3> vertexNormals(fileNormals.empty() ? 0 : cache.size(), Vector3{ 0.0f, 1.0f, 0.0f, 0.0f });
+			ReadObjFaces(file, [&](const int* v, const int* vn)
+				{
+					for (int k = 0; k < 3; ++k)
+					{
+						indices.push_back(v[k]);
+						if (ObjIndexValid(v[k], cache) && ObjIndexValid(vn[k], fileNormals))
+						{
+							vertexNormals[v[k]] = fileNormals[vn[k]];
+							hasNormals = true;
+						}
+					}
+				});
+
+			if (hasNormals)
+				normals.swap(vertexNormals);
+			return true;
+		}
+
+		// just the v and vn lines, the faces are left to ReadObjFaces so a
+		// big file never has to hold them all at once
+		static bool ReadObjVertices(const std::string& file, std::vector<Vector3>& positions, std::vector<Vector3>& normals)
 		{
 			std::ifstream obj(file);
 			if (!obj.is_open())
 				return false;
 
-			std::vector<Vector3> cache;
 			while (!obj.eof())
 			{
 				char line[128]{};
@@ -47,70 +309,732 @@ private:
 
 				std::strstream str;
 				str << line;
-				if (line[0] == 'v')
+				if (line[0] == 'v' && line[1] == ' ')
 				{
 					Vector3 v{};
 					str >> junk >> v.x >> v.y >> v.z;
-					cache.push_back(v);
+					positions.push_back(v);
+				}
+				if (line[0] == 'v' && line[1] == 'n')
+				{
+					Vector3 n{ 0.0f, 0.0f, 0.0f, 0.0f };
+					str >> junk >> junk >> n.x >> n.y >> n.z;
+					normals.push_back(n);
 				}
-				if (line[0] == 'f')
+			}
+			return true;
+		}
+
+		// face(v, vn) for every f line as it is read, three 0 based corners
+		// each. vn is -1 where a corner names no normal ( v or v/vt )
+		template<typename Face>
+		static bool ReadObjFaces(const std::string& file, Face face)
+		{
+			std::ifstream obj(file);
+			if (!obj.is_open())
+				return false;
+
+			while (!obj.eof())
+			{
+				char line[128]{};
+				char junk{};
+				obj.getline(line, 128);
+				if (line[0] != 'f')
+					continue;
+
+				std::strstream str;
+				str << line;
+				str >> junk;
+				int v[3], vn[3];
+				for (int k = 0; k < 3; ++k)
 				{
-					int f[3]{};
-					str >> junk >> f[0] >> f[1] >> f[2];
-					triangles.push_back({ cache[f[0] - 1], cache[f[1] - 1], cache[f[2] - 1] });
+					// v, v/vt, v//vn or v/vt/vn
+					std::string token;
+					str >> token;
+					v[k] = atoi(token.c_str()) - 1;
+					size_t slash = token.rfind('/');
+					vn[k] = (slash != std::string::npos && token.find('/') != slash) ? atoi(token.c_str() + slash + 1) - 1 : -1;
 				}
+				face(v, vn);
+			}
+			return true;
+		}
+
+		static bool ObjIndexValid(int i, const std::vector<Vector3>& of)
+		{
+			return i >= 0 && i < (int)of.size();
+		}
+
+		// smooth normal per vertex, the faces around it weighted by their area
+		static std::vector<Vector3> VertexNormals(const std::vector<Vector3>& positions, const std::vector<int>& indices)
+		{
+			std::vector<Vector3> normals(positions.size(), Vector3{ 0.0f, 0.0f, 0.0f, 0.0f });
+			for (size_t i = 0; i + 2 < indices.size(); i += 3)
+			{
+				Vector3 n = FaceNormal(positions[indices[i]], positions[indices[i + 1]], positions[indices[i + 2]]);
+				for (int k = 0; k < 3; ++k)
+				{
+					Vector3& v = normals[indices[i + k]];
+					v = { v.x + n.x, v.y + n.y, v.z + n.z, 0.0f };
+				}
+			}
+
+			Normalise(normals);
+			return normals;
+		}
+
+		// zero length ones are left as they are
+		static void Normalise(std::vector<Vector3>& normals)
+		{
+			for (auto& v : normals)
+			{
+				float length = sqrtf(v.x * v.x + v.y * v.y + v.z * v.z);
+				if (length > 0.0f)
+					v = { v.x / length, v.y / length, v.z / length, 0.0f };
+			}
+		}
+
+		// a normal for each corner of the triangles in indices. The vertex's
+		// smooth one, unless the face bends more than 45 degrees away from it
+		// like the sides of a box, then the face's own so the crease stays sharp
+		static void AppendCornerNormals(const std::vector<Vector3>& positions, const std::vector<int>& indices,
+			const std::vector<Vector3>& vertexNormals, std::vector<Vector3>& out)
+		{
+			for (size_t i = 0; i + 2 < indices.size(); i += 3)
+			{
+				Vector3 n = FaceNormal(positions[indices[i]], positions[indices[i + 1]], positions[indices[i + 2]]);
+				float length = sqrtf(n.x * n.x + n.y * n.y + n.z * n.z);
+				n = length > 0.0f ? Vector3{ n.x / length, n.y / length, n.z / length, 0.0f } : Vector3{ 0.0f, 0.0f, 0.0f, 0.0f };
+
+				for (int k = 0; k < 3; ++k)
+				{
+					const Vector3& v = vertexNormals[indices[i + k]];
+					out.push_back(v.x * n.x + v.y * n.y + v.z * n.z >= 0.7f ? v : n);
+				}
+			}
+		}
+
+		// simplify at load time, halving the triangle count per level until
+		// it gets small or the simplifier stops making progress. The
+		// simplifier keeps vertex numbers, so every level is lit with the
+		// normals of the full mesh and shading holds when levels switch. A
+		// pass only measures how far it moved from the level before, so the
+		// errors add up to bound how far a level is from the original
+		void BuildLevels(std::vector<Vector3> positions, std::vector<int> indices, std::vector<Vector3> vertexNormals = {})
+		{
+			levels.clear();
+			if (vertexNormals.size() != positions.size())
+				vertexNormals = VertexNormals(positions, indices);
+
+			Vector3 lo = positions.empty() ? Vector3{} : positions[0];
+			Vector3 hi = lo;
+			for (auto& p : positions)
+			{
+				lo = { min(lo.x, p.x), min(lo.y, p.y), min(lo.z, p.z) };
+				hi = { max(hi.x, p.x), max(hi.y, p.y), max(hi.z, p.z) };
 			}
+			center = { 0.5f * (lo.x + hi.x), 0.5f * (lo.y + hi.y), 0.5f * (lo.z + hi.z) };
+			radius = 0.0f;
+			for (auto& p : positions)
+			{
+				float dx = p.x - center.x, dy = p.y - center.y, dz = p.z - center.z;
+				radius = max(radius, sqrtf(dx * dx + dy * dy + dz * dz));
+			}
+
+			float error = 0.0f;
+			while (true)
+			{
+				MeshLevel level;
+				level.error = error;
+				for (size_t i = 0; i + 2 < indices.size(); i += 3)
+					level.triangles.push_back({ { positions[indices[i]], positions[indices[i + 1]], positions[indices[i + 2]] } });
+				AppendCornerNormals(positions, indices, vertexNormals, level.cornerNormals);
+				level.BuildClusters();
+				levels.push_back(std::move(level));
+
+				size_t triangles = indices.size() / 3;
+				if (triangles <= 128 || levels.size() >= 6)
+					break;
+
+				error += Simplify(positions, indices, triangles / 2);
+				if (indices.size() / 3 > triangles * 4 / 5)
+					break;
+			}
+		}
+
+		// symmetric 4x4 of the summed squared distances to a set of planes
+		struct Quadric
+		{
+			double m[10]{};
+
+			void AddPlane(double a, double b, double c, double d, double w)
+			{
+				m[0] += w * a * a; m[1] += w * a * b; m[2] += w * a * c; m[3] += w * a * d;
+				m[4] += w * b * b; m[5] += w * b * c; m[6] += w * b * d;
+				m[7] += w * c * c; m[8] += w * c * d;
+				m[9] += w * d * d;
+			}
+
+			void Add(const Quadric& q)
+			{
+				for (int i = 0; i < 10; ++i)
+					m[i] += q.m[i];
+			}
+
+			double Error(const Vector3& v) const
+			{
+				double x = v.x, y = v.y, z = v.z;
+				return m[0] * x * x + 2.0 * m[1] * x * y + 2.0 * m[2] * x * z + 2.0 * m[3] * x +
+					m[4] * y * y + 2.0 * m[5] * y * z + 2.0 * m[6] * y +
+					m[7] * z * z + 2.0 * m[8] * z + m[9];
+			}
+		};
+
+		static Vector3 FaceNormal(const Vector3& p0, const Vector3& p1, const Vector3& p2)
+		{
+			return Vector3_CrossProduct(Vector3_Sub(p1, p0), Vector3_Sub(p2, p0));
+		}
+
+		// height of the triangle straight above or below x, z, false when x, z
+		// is outside it or it stands on its edge
+		static bool HeightAt(const Vector3& a, const Vector3& b, const Vector3& c, float x, float z, float& y)
+		{
+			float area = (b.z - c.z) * (a.x - c.x) + (c.x - b.x) * (a.z - c.z);
+			if (fabsf(area) < 1e-6f)
+				return false;
 
+			float u = ((b.z - c.z) * (x - c.x) + (c.x - b.x) * (z - c.z)) / area;
+			float v = ((c.z - a.z) * (x - c.x) + (a.x - c.x) * (z - c.z)) / area;
+			if (u < 0.0f || v < 0.0f || u + v > 1.0f)
+				return false;
+
+			y = u * a.y + v * b.y + (1.0f - u - v) * c.y;
 			return true;
 		}
+
+		// for heightfields like the terrain, the furthest any corner of a is
+		// from surface b, going by the plane of the triangle of b straight
+		// above or below it. Corners b doesn't cover are left out. b's
+		// triangles go into a grid over its extent first, a couple per square
+		static float HeightGap(const std::vector<Vector3>& pa, const std::vector<int>& ia, const std::vector<Vector3>& pb, const std::vector<int>& ib)
+		{
+			if (ib.size() < 3)
+				return 0.0f;
+
+			Vector3 lo = pb[ib[0]];
+			Vector3 hi = lo;
+			for (int i : ib)
+			{
+				lo = { min(lo.x, pb[i].x), 0.0f, min(lo.z, pb[i].z) };
+				hi = { max(hi.x, pb[i].x), 0.0f, max(hi.z, pb[i].z) };
+			}
+
+			const int n = max(1, (int)sqrtf(ib.size() / 6.0f));
+			const float sx = n / max(1e-6f, hi.x - lo.x);
+			const float sz = n / max(1e-6f, hi.z - lo.z);
+			auto cellX = [&](float x) { return max(0, min(n - 1, (int)((x - lo.x) * sx))); };
+			auto cellZ = [&](float z) { return max(0, min(n - 1, (int)((z - lo.z) * sz))); };
+
+			std::vector<std::vector<int>> grid(n * n);
+			for (size_t f = 0; f + 2 < ib.size(); f += 3)
+			{
+				const Vector3& a = pb[ib[f]];
+				const Vector3& b = pb[ib[f + 1]];
+				const Vector3& c = pb[ib[f + 2]];
+				for (int z = cellZ(min(a.z, min(b.z, c.z))); z <= cellZ(max(a.z, max(b.z, c.z))); ++z)
+					for (int x = cellX(min(a.x, min(b.x, c.x))); x <= cellX(max(a.x, max(b.x, c.x))); ++x)
+						grid[x + z * n].push_back((int)f);
+			}
+
+			float worst = 0.0f;
+			for (int i : ia)
+			{
+				const Vector3& p = pa[i];
+				bool covered = false;
+				float gap = 0.0f;
+				for (int f : grid[cellX(p.x) + cellZ(p.z) * n])
+				{
+					const Vector3& a = pb[ib[f]];
+					const Vector3& b = pb[ib[f + 1]];
+					const Vector3& c = pb[ib[f + 2]];
+					float y;
+					if (!HeightAt(a, b, c, p.x, p.z, y))
+						continue;
+
+					// straight down overstates it on steep slopes, the plane is
+					// only |n.y| of that away
+					Vector3 normal = FaceNormal(a, b, c);
+					float length = sqrtf(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+					float distance = fabsf(p.y - y) * fabsf(normal.y) / length;
+					gap = covered ? min(gap, distance) : distance;
+					covered = true;
+				}
+				if (covered)
+					worst = max(worst, gap);
+			}
+			return worst;
+		}
+
+		// quadric error metrics (Garland & Heckbert), keep collapsing whichever
+		// edge disturbs the surface least until the budget is met. Collapses that
+		// would fold a face over are skipped and open borders are pinned with
+		// extra planes so the silhouette holds. Returns the worst error accepted
+		static float Simplify(std::vector<Vector3>& positions, std::vector<int>& indices, size_t targetTriangles)
+		{
+			const int vertexCount = (int)positions.size();
+			const int faceCount = (int)indices.size() / 3;
+
+			std::vector<Quadric> quadrics(vertexCount);
+			std::vector<std::vector<int>> vertexFaces(vertexCount);
+			std::vector<bool> faceAlive(faceCount, true);
+			std::vector<bool> vertexAlive(vertexCount, true);
+			std::vector<unsigned> stamp(vertexCount, 0);
+
+			auto corner = [&](int f, int k) -> int& { return indices[f * 3 + k]; };
+
+			std::vector<std::pair<uint64_t, int>> edges;
+			for (int f = 0; f < faceCount; ++f)
+			{
+				Vector3 n = FaceNormal(positions[corner(f, 0)], positions[corner(f, 1)], positions[corner(f, 2)]);
+				double length = sqrt((double)n.x * n.x + (double)n.y * n.y + (double)n.z * n.z);
+				for (int k = 0; k < 3; ++k)
+				{
+					int a = corner(f, k);
+					int b = corner(f, (k + 1) % 3);
+					vertexFaces[a].push_back(f);
+					edges.push_back({ ((uint64_t)min(a, b) << 32) | (uint32_t)max(a, b), f });
+
+					if (length > 0.0)
+					{
+						const Vector3& p = positions[a];
+						double d = -(n.x * p.x + n.y * p.y + n.z * p.z) / length;
+						quadrics[a].AddPlane(n.x / length, n.y / length, n.z / length, d, 1.0);
+					}
+				}
+			}
+
+			// an edge only one face uses is a border, give it a stiff plane
+			// standing up along the edge so it doesn't get eaten
+			std::sort(edges.begin(), edges.end());
+			for (size_t i = 0; i < edges.size(); ++i)
+			{
+				bool shared = (i > 0 && edges[i - 1].first == edges[i].first) ||
+					(i + 1 < edges.size() && edges[i + 1].first == edges[i].first);
+				if (shared)
+					continue;
+
+				int a = (int)(edges[i].first >> 32);
+				int b = (int)(edges[i].first & 0xFFFFFFFF);
+				int f = edges[i].second;
+				Vector3 n = FaceNormal(positions[corner(f, 0)], positions[corner(f, 1)], positions[corner(f, 2)]);
+				Vector3 e{ positions[b].x - positions[a].x, positions[b].y - positions[a].y, positions[b].z - positions[a].z };
+				Vector3 side{ e.y * n.z - e.z * n.y, e.z * n.x - e.x * n.z, e.x * n.y - e.y * n.x };
+				double length = sqrt((double)side.x * side.x + (double)side.y * side.y + (double)side.z * side.z);
+				if (length <= 0.0)
+					continue;
+
+				const Vector3& p = positions[a];
+				double d = -(side.x * p.x + side.y * p.y + side.z * p.z) / length;
+				quadrics[a].AddPlane(side.x / length, side.y / length, side.z / length, d, 10.0);
+				quadrics[b].AddPlane(side.x / length, side.y / length, side.z / length, d, 10.0);
+			}
+
+			struct Candidate
+			{
+				double cost;
+				int a, b;
+				unsigned stampA, stampB;
+				Vector3 target;
+				bool operator<(const Candidate& c) const { return cost > c.cost; }
+			};
+
+			std::priority_queue<Candidate> heap;
+			auto consider = [&](int a, int b)
+			{
+				Quadric q = quadrics[a];
+				q.Add(quadrics[b]);
+
+				// the optimal point needs a 3x3 solve that can go unstable on
+				// flat patches, picking the best of ends and middle is robust
+				const Vector3& pa = positions[a];
+				const Vector3& pb = positions[b];
+				Vector3 options[3] = { pa, pb, { 0.5f * (pa.x + pb.x), 0.5f * (pa.y + pb.y), 0.5f * (pa.z + pb.z) } };
+				Candidate c{ q.Error(options[0]), a, b, stamp[a], stamp[b], options[0] };
+				for (int i = 1; i < 3; ++i)
+				{
+					double cost = q.Error(options[i]);
+					if (cost < c.cost)
+					{
+						c.cost = cost;
+						c.target = options[i];
+					}
+				}
+				c.cost = max(c.cost, 0.0);
+				heap.push(c);
+			};
+
+			for (size_t i = 0; i < edges.size(); ++i)
+				if (i == 0 || edges[i - 1].first != edges[i].first)
+					consider((int)(edges[i].first >> 32), (int)(edges[i].first & 0xFFFFFFFF));
+
+			// moving v to target must not turn any of its faces (other than the
+			// ones that disappear with the edge) upside down
+			auto flips = [&](int v, int other, const Vector3& target)
+			{
+				for (int f : vertexFaces[v])
+				{
+					if (!faceAlive[f])
+						continue;
+
+					Vector3 p[3];
+					bool collapsing = false;
+					for (int k = 0; k < 3; ++k)
+					{
+						int i = corner(f, k);
+						collapsing |= (i == other);
+						p[k] = (i == v) ? target : positions[i];
+					}
+					if (collapsing)
+						continue;
+
+					Vector3 before = FaceNormal(positions[corner(f, 0)], positions[corner(f, 1)], positions[corner(f, 2)]);
+					Vector3 after = FaceNormal(p[0], p[1], p[2]);
+					if (before.x * after.x + before.y * after.y + before.z * after.z <= 0.0f)
+						return true;
+				}
+				return false;
+			};
+
+			size_t liveFaces = faceCount;
+			double worst = 0.0;
+			std::vector<int> neighbours;
+
+			while (liveFaces > targetTriangles && !heap.empty())
+			{
+				Candidate c = heap.top();
+				heap.pop();
+
+				if (!vertexAlive[c.a] || !vertexAlive[c.b] || stamp[c.a] != c.stampA || stamp[c.b] != c.stampB)
+					continue;
+				if (flips(c.a, c.b, c.target) || flips(c.b, c.a, c.target))
+					continue;
+
+				// fold b into a
+				positions[c.a] = c.target;
+				quadrics[c.a].Add(quadrics[c.b]);
+				vertexAlive[c.b] = false;
+				++stamp[c.a];
+				worst = max(worst, c.cost);
+
+				for (int f : vertexFaces[c.b])
+				{
+					if (!faceAlive[f])
+						continue;
+
+					bool degenerate = false;
+					for (int k = 0; k < 3; ++k)
+						degenerate |= (corner(f, k) == c.a);
+
+					if (degenerate)
+					{
+						faceAlive[f] = false;
+						--liveFaces;
+						continue;
+					}
+
+					for (int k = 0; k < 3; ++k)
+						if (corner(f, k) == c.b)
+							corner(f, k) = c.a;
+					vertexFaces[c.a].push_back(f);
+				}
+				vertexFaces[c.b].clear();
+
+				auto& faces = vertexFaces[c.a];
+				faces.erase(std::remove_if(faces.begin(), faces.end(), [&](int f) { return !faceAlive[f]; }), faces.end());
+
+				neighbours.clear();
+				for (int f : faces)
+					for (int k = 0; k < 3; ++k)
+						if (corner(f, k) != c.a)
+							neighbours.push_back(corner(f, k));
+				std::sort(neighbours.begin(), neighbours.end());
+				neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+
+				for (int n : neighbours)
+					consider(c.a, n);
+			}
+
+			std::vector<int> kept;
+			kept.reserve(liveFaces * 3);
+			for (int f = 0; f < faceCount; ++f)
+				if (faceAlive[f])
+					for (int k = 0; k < 3; ++k)
+						kept.push_back(corner(f, k));
+			indices.swap(kept);
+
+			return (float)sqrt(worst);
+		}
 	};
 
-	struct Matrix
+	// everything the geometry stage reads, shared by the workers
+	struct GeometryPass
 	{
-		float v[4][4]{};
+		Matrix world;
+		Matrix worldView;
+		Matrix projection;
+		Vector3 camera;
+
+		// camera and light brought into the mesh's own space, so the stored
+		// normals can be used as they are
+		Vector3 cameraObject;
+		Vector3 lightObject;
+
+		// depthPyramid is filled in and clusters may be tested against it
+		bool occlusion = false;
 	};
 
-private:
-	Mesh cube;
-	Matrix projection;
+	// one level of the hierarchical depth buffer, 0 is per cell
+	struct DepthLevel
+	{
+		int width;
+		int height;
+		std::vector<float> depth;
+	};
 
-	Vector3 camera{10.0f, 10.0f, 0.0f};
-	Vector3 viewDir;
-	float yaw;
-	float angle;
+	struct Plane
+	{
+		Vector3 normal; // normalised once when the plane is built
+		float d{};
+	};
 
-protected:
-	virtual bool OnAwake() override
+	// 8 byte record the painter's sort works on, the key is precomputed once
+	// per triangle so sorting never goes back to the vertices
+	struct DepthKey
 	{
-		//cube.triangles =
-		//{
-		//	// S
-		//	{ 0.0f, 0.0f, 0.0f,   0.0f, 1.0f, 0.0f,   1.0f, 1.0f, 0.0f },
-		//	{ 0.0f, 0.0f, 0.0f,   1.0f, 1.0f, 0.0f,   1.0f, 0.0f, 0.0f },
+		uint32_t key;
+		uint32_t index;
+	};
 
-		//	// E
-		//	{ 1.0f, 0.0f, 0.0f,   1.0f, 1.0f, 0.0f,   1.0f, 1.0f, 1.0f },
-		//	{ 1.0f, 0.0f, 0.0f,   1.0f, 1.0f, 1.0f,   1.0f, 0.0f, 1.0f },
+	// everything the picture depends on, camera pose included through the
+	// view matrix. Compared bitwise against the last drawn frame
+	struct FrameState
+	{
+		Matrix world;
+		Matrix view;
+		Matrix projection;
+		Vector3 light;
+	};
 
-		//	// N
-		//	{ 1.0f, 0.0f, 1.0f,   1.0f, 1.0f, 1.0f,   0.0f, 1.0f, 1.0f },
-		//	{ 1.0f, 0.0f, 1.0f,   0.0f, 1.0f, 1.0f,   0.0f, 0.0f, 1.0f },
+	// fixed size polygon for clipping, a triangle only gains one vertex per
+	// plane so near + four edges can never overflow this
+	struct ClipPolygon
+	{
+		Vector3 vertices[9];
+		float luminance[9];
+		int count{};
+	};
 
-		//	// W                                                      
-		//	{ 0.0f, 0.0f, 1.0f,   0.0f, 1.0f, 1.0f,   0.0f, 1.0f, 0.0f },
-		//	{ 0.0f, 0.0f, 1.0f,   0.0f, 1.0f, 0.0f,   0.0f, 0.0f, 0.0f },
+	// clusters [first, last) of one level, the unit of work for the pool.
+	// luminance is the corners' from the owner's shade cache, null lights
+	// them from the level's corner normals as they're drawn
+	struct GeometryBatch
+	{
+		GeometryPass* pass;
+		MeshLevel* level;
+		const float* luminance;
+		int first;
+		int last;
+	};
 
-		//	// U                                      
-		//	{ 0.0f, 1.0f, 0.0f,   0.0f, 1.0f, 1.0f,   1.0f, 1.0f, 1.0f },
-		//	{ 0.0f, 1.0f, 0.0f,   1.0f, 1.0f, 1.0f,   1.0f, 1.0f, 0.0f },
+	// a placed copy of a library mesh. transform and the bounding sphere are
+	// relative to the terrain, the mesh's triangles, normals, corner normals
+	// and clusters are shared by every object using it, nothing is kept per
+	// copy. transform has to be rigid, turns and moves only
+	struct SceneObject
+	{
+		int mesh{};
+		Matrix transform;
+		Vector3 center;
+		float radius{};
+	};
+
+	// a tile's full detail is level 0, each next one has about half the
+	// triangles, so the last is down to a sixteenth
+	static const int TileLevels = 5;
+
+	// one of a tile's levels, paged in from the tile file around the camera
+	// and dropped again once it has gone unused
+	struct TileLevel
+	{
+		uint64_t offset{};
+		uint32_t count{};
+		float error{};
+		std::unique_ptr<MeshLevel> mesh;
+		bool queued = false;
+		bool broken = false; // couldn't be read, the tile makes do without it
+		int lastUsed{};
+	};
 
-		//	// D                                                    
-		//	{ 1.0f, 0.0f, 1.0f,   0.0f, 0.0f, 1.0f,   0.0f, 0.0f, 0.0f },
-		//	{ 1.0f, 0.0f, 1.0f,   0.0f, 0.0f, 0.0f,   1.0f, 0.0f, 0.0f },
-		//};
+	// one square of the terrain grid. Every tile only keeps its bounds and
+	// where its levels are in the tile file, the triangles are resident just
+	// for the tiles around the camera. standIn is the coarsest level close
+	// enough to the surface to occlude with, it is kept while the tile is in
+	// view and drawn until the level picked for the distance comes in
+	struct TerrainTile
+	{
+		Vector3 center;
+		float radius{};
+		int levelCount{};
+		int standIn{};
+		TileLevel levels[TileLevels];
+	};
 
+	// all the loader thread gets to see of a tile
+	struct TileRequest
+	{
+		int tile;
+		int level;
+		uint64_t offset;
+		uint32_t count;
+	};
+
+	// a level Terrain_Update would like resident this frame
+	struct WantedLevel
+	{
+		bool standIn;
+		float distance;
+		int tile;
+		int level;
+	};
+
+	// tile file layout: the header, a record per tile, then the tiles' levels
+	// in whatever order they were baked. A triangle is stored as its three
+	// corners followed by the three corner normals
+	static const int TileTriangleFloats = 18;
+
+	struct TileFileHeader
+	{
+		char magic[4];
+		int32_t tilesX;
+		int32_t tilesZ;
+		float originX;
+		float originZ;
+		float tileSize;
+
+		// size and write time of the OBJ it was baked from, a tile file that
+		// doesn't match its OBJ any more gets baked again
+		uint64_t sourceSize;
+		uint64_t sourceTime;
+	};
+
+	struct TileFileLevel
+	{
+		uint64_t offset;
+		uint32_t count;
+		float error;
+	};
+
+	// levels past levelCount are left zero
+	struct TileFileRecord
+	{
+		float center[3];
+		float radius;
+		int32_t levelCount;
+		int32_t standIn;
+		TileFileLevel levels[TileLevels];
+	};
+
+private:
+	Matrix projection;
+	Plane nearPlane;
+	Plane guardBand[4];
+	Vector3 guardMin;
+	Vector3 guardMax;
+	std::vector<std::vector<Triangle>> geometryBins;
+	std::vector<DepthKey> depthKeys;
+	std::vector<DepthKey> depthScratch;
+
+	Vector3 camera{10.0f, 10.0f, 0.0f};
+	Vector3 viewDir;
+	float yaw{};
+	float angle{};
+	Vector3 light{ 0.0f, 1.0f, -1.0f, 0.0f };
+
+	// GetColor's 13 levels with RampPad copies of the ends on either side,
+	// so a dithered luminance that runs a little past the ends still lands
+	// in the table. Entries are 1/256 of a level, see Raster_ShadedTriangle
+	static const int RampLevels = 13;
+	static const int RampPad = 4;
+	CHAR_INFO ramp[RampLevels + 2 * RampPad];
+
+	// what screenBuffer was last drawn with
+	FrameState lastFrame;
+	bool lastFrameValid = false;
+	int renderFrame{};
+
+	// meshes loaded once, and everything placed in the world using them
+	std::vector<Mesh> meshLibrary;
+	std::vector<SceneObject> scene;
+	int propCount = 0;
+
+	// how many cells a LOD's simplification error may span on screen, for
+	// scene objects and terrain tiles alike
+	float lodErrorCells = 1.0f;
+
+	// the tiles' stand ins are simplified as far as their error stays under
+	// this fraction of the terrain's radius, they double as the occluders
+	float occluderError = 0.05f;
+	std::vector<DepthLevel> depthPyramid;
+
+	// terrain grid. Tiles within viewRadius of the camera (object space
+	// units) are drawn, each at the level its distance calls for. Levels
+	// are paged in as long as they fit in terrainBudget bytes, so what is
+	// resident depends on the budget and not on the world's size
+	std::string tilePath;
+	std::vector<TerrainTile> tiles;
+	std::vector<std::pair<int, int>> residentLevels; // tile, level
+	int tilesX{};
+	int tilesZ{};
+	float tileOriginX{};
+	float tileOriginZ{};
+	float tileSize{};
+	float viewRadius = 400.0f;
+	size_t terrainBudget = 512 * 1024;
+	size_t terrainBytes{}; // resident or on the way
+	int terrainFrame{};
+
+	// triangles the baker sorts into tiles at once, the OBJ is read again
+	// for each run of tile rows that holds about this many
+	size_t bakeChunk = 1 << 20;
+
+	// shared with the loader thread and only touched under tileLock
+	std::thread tileLoader;
+	std::mutex tileLock;
+	std::condition_variable tileWake;
+	std::vector<TileRequest> tileRequests; // nearest last
+	std::vector<std::pair<TileRequest, std::unique_ptr<MeshLevel>>> tilesLoaded;
+	bool tileLoaderQuit = false;
+
+protected:
+	virtual bool OnAwake() override
+	{
 		//cube.LoadObjFile("D:\\dev\\Console69\\Console69\\obj\\mountains.obj");
-		cube.LoadObjFile("obj\\mountains.obj");
+		tilePath = "obj\\mountains.tiles";
+		const std::string objPath = "obj\\mountains.obj";
+		if (!Terrain_Open(tilePath, objPath))
+		{
+			// first run, an old file or the OBJ changed since, cut it up once
+			if (!Terrain_Bake(objPath, tilePath, 32.0f) || !Terrain_Open(tilePath, objPath))
+				return false;
+		}
+		tileLoader = std::thread(&World::Terrain_Loader, this);
+
+		// crates strewn over the terrain, all drawn from one mesh
+		if (propCount > 0)
+		{
+			int crate = Scene_AddMesh(Mesh::MakeBox(2.0f));
+			Scene_Scatter(crate, propCount);
+		}
 
 		float fov = 90.0f;
 		float ratio = (float)GetScreenHeight() / (float)GetScreenWidth();
@@ -119,6 +1043,30 @@ protected:
 
 		projection = Matrix_GetProjection(fov, ratio, eyeNear, eyeFar);
 
+		// the middle of each level so GetColor can't round into the next one,
+		// anything past the top one ( a luminance of exactly 1 ) is clamped to it
+		for (int i = 0; i < RampLevels + 2 * RampPad; ++i)
+		{
+			int level = max(0, min(RampLevels - 1, i - RampPad));
+			ramp[i] = GetColor((level + 0.5f) / (float)RampLevels);
+		}
+
+		// triangles inside the guard band are left to the rasterizer's bounding
+		// box clipping, only the rare huge ones get clipped geometrically
+		guardMin = { -(float)GetScreenWidth(), -(float)GetScreenHeight(), 0.0f };
+		guardMax = { 2.0f * GetScreenWidth() - 1.0f, 2.0f * GetScreenHeight() - 1.0f, 0.0f };
+		nearPlane = Plane_Make({ 0.0f, 0.0f, eyeNear }, { 0.0f, 0.0f, 1.0f });
+		guardBand[0] = Plane_Make(guardMin, { 0.0f, 1.0f, 0.0f });
+		guardBand[1] = Plane_Make(guardMax, { 0.0f, -1.0f, 0.0f });
+		guardBand[2] = Plane_Make(guardMin, { 1.0f, 0.0f, 0.0f });
+		guardBand[3] = Plane_Make(guardMax, { -1.0f, 0.0f, 0.0f });
+
+		return true;
+	}
+
+	virtual bool OnDestroy() override
+	{
+		Terrain_StopLoader();
 		return true;
 	}
 
@@ -148,6 +1096,14 @@ protected:
 		if (GetKey(L'D').Hold)
 			yaw += 2.0f * deltaTime;
 
+		// L trades detail for triangles, letting the levels' errors span 1,
+		// 2, 4 then 8 cells before going back to 1
+		if (GetKey(L'L').Press)
+		{
+			lodErrorCells = lodErrorCells >= 8.0f ? 1.0f : lodErrorCells * 2.0f;
+			lastFrameValid = false;
+		}
+
 
 		Matrix Z = Matrix_GetRotationZ(0.5f * angle);
 		Matrix X = Matrix_GetRotationX(angle);
@@ -168,451 +1124,1240 @@ protected:
 		// view matrix from camera
 		Matrix viewMatrix = Matrix_QuickInverse(cameraMatrix);
 
-		// store triangles for raster
-		std::vector<Triangle> trianglesToRaster;
-
-		for (auto& tri : cube.triangles)
-		{
-			Triangle projected{}, transformed{}, viewed{};
-
-			// world matrix transformation
-			transformed.vertices[0] = Matrix_MultiplyVector(world, tri.vertices[0]);
-			transformed.vertices[1] = Matrix_MultiplyVector(world, tri.vertices[1]);
-			transformed.vertices[2] = Matrix_MultiplyVector(world, tri.vertices[2]);
-
-			// calculate triangles normal
-			Vector3 line1 = Vector3_Sub(transformed.vertices[1], transformed.vertices[0]);
-			Vector3 line2 = Vector3_Sub(transformed.vertices[2], transformed.vertices[0]);
-			Vector3 normal = Vector3_CrossProduct(line1, line2);
-			normal = Vector3_Normalize(normal);
-
-			// ray from triangle to camera
-			Vector3 ray = Vector3_Sub(transformed.vertices[0], camera);
-
-			// only draw the triangles when ray is aligned with normal
-			if (Vector3_DotProduct(normal, ray) < 0.0f)
-			{
-				// genjutsu
-				Vector3 light{ 0.0f,1.0f,-1.0f };
-				light = Vector3_Normalize(light);
-
-				// how aligned
-				float dp = max(0.1f, Vector3_DotProduct(light, normal));
-
-				// console bs
-				CHAR_INFO ci = GetColor(dp);
-				transformed.color = ci.Attributes;
-				transformed.symbol = ci.Char.UnicodeChar;
-
-				// world space -> view space
-				viewed.vertices[0] = Matrix_MultiplyVector(viewMatrix, transformed.vertices[0]);
-				viewed.vertices[1] = Matrix_MultiplyVector(viewMatrix, transformed.vertices[1]);
-				viewed.vertices[2] = Matrix_MultiplyVector(viewMatrix, transformed.vertices[2]);
-				viewed.symbol = transformed.symbol;
-				viewed.color = transformed.color;
-
-				// clip triangles against near
-				int clippedTriangles{};
-				Triangle clipped[2];
-				clippedTriangles = Triangle_ClipAgainstPlane(
-					{ 0.0f, 0.0f, 0.1f }, { 0.0f, 0.0f, 1.0f },
-					viewed, clipped[0], clipped[1]
-				);
-
-				// project when multiple triangles form the clip
-				for (int n = 0; n < clippedTriangles; ++n)
-				{
-					// project triangles from 3D --> 2D
-					projected.vertices[0] = Matrix_MultiplyVector(projection, clipped[n].vertices[0]);
-					projected.vertices[1] = Matrix_MultiplyVector(projection, clipped[n].vertices[1]);
-					projected.vertices[2] = Matrix_MultiplyVector(projection, clipped[n].vertices[2]);
-					projected.color = clipped[n].color;
-					projected.symbol = clipped[n].symbol;
-
-					// scale into view, we moved the normalising into cartesian space
-					// out of the matrix.vector function from the previous videos, so
-					// do this manually
-					projected.vertices[0] = Vector3_Div(projected.vertices[0], projected.vertices[0].w);
-					projected.vertices[1] = Vector3_Div(projected.vertices[1], projected.vertices[1].w);
-					projected.vertices[2] = Vector3_Div(projected.vertices[2], projected.vertices[2].w);
-
-					// X/Y are inverted so put them back
-					projected.vertices[0].x *= -1.0f;
-					projected.vertices[1].x *= -1.0f;
-					projected.vertices[2].x *= -1.0f;
-					projected.vertices[0].y *= -1.0f;
-					projected.vertices[1].y *= -1.0f;
-					projected.vertices[2].y *= -1.0f;
-
-					// offset verts into visible normalised space
-					Vector3 vOffsetView = { 1,1,0 };
-					projected.vertices[0] = Vector3_Add(projected.vertices[0], vOffsetView);
-					projected.vertices[1] = Vector3_Add(projected.vertices[1], vOffsetView);
-					projected.vertices[2] = Vector3_Add(projected.vertices[2], vOffsetView);
-					projected.vertices[0].x *= 0.5f * (float)GetScreenWidth();
-					projected.vertices[0].y *= 0.5f * (float)GetScreenHeight();
-					projected.vertices[1].x *= 0.5f * (float)GetScreenWidth();
-					projected.vertices[1].y *= 0.5f * (float)GetScreenHeight();
-					projected.vertices[2].x *= 0.5f * (float)GetScreenWidth();
-					projected.vertices[2].y *= 0.5f * (float)GetScreenHeight();
-
-					// store triangle for sorting
-					trianglesToRaster.push_back(projected);
-				}
+		Matrix worldInverse = Matrix_QuickInverse(world);
+		Vector3 cameraObject = Matrix_MultiplyVector(worldInverse, camera);
+
+		// tiles arriving from the loader change the picture as well
+		bool terrainChanged = Terrain_Update(cameraObject);
+
+		// nothing moved since the last frame, so the screen already shows it
+		FrameState state{ world, viewMatrix, projection, light };
+		if (!terrainChanged && lastFrameValid && memcmp(&state, &lastFrame, sizeof(state)) == 0)
+		{
+			screenUnchanged = true;
+			return true;
+		}
+		lastFrame = state;
+		lastFrameValid = true;
+		++renderFrame;
+
+		// genjutsu
+		Vector3 lightObject = Matrix_MultiplyVector(worldInverse, light);
+
+		GeometryPass pass{};
+		pass.world = world;
+		pass.worldView = Matrix_MultiplyMatrix(world, viewMatrix);
+		pass.projection = projection;
+		pass.camera = camera;
+		pass.cameraObject = cameraObject;
+		pass.lightObject = Vector3_Normalize(lightObject);
+
+		// tiles in view around the camera that are on screen. Only the window
+		// of the grid they can be in is looked at, a tile with nothing
+		// resident yet is left out until the loader gets to it
+		typedef std::pair<TerrainTile*, MeshLevel*> VisibleTile;
+		FrameVector<VisibleTile> visible{ ArenaAllocator<VisibleTile>(frameArena) };
+		int x0, z0, x1, z1;
+		Terrain_Window(cameraObject, viewRadius, x0, z0, x1, z1);
+		for (int z = z0; z <= z1; ++z)
+			for (int x = x0; x <= x1; ++x)
+			{
+				TerrainTile& tile = tiles[x + z * tilesX];
+				if (tile.levels[0].count == 0 || Tile_Distance(tile, cameraObject) >= viewRadius || Sphere_Hidden(tile.center, tile.radius, pass))
+					continue;
+
+				MeshLevel* level = Tile_DrawLevel(tile, Tile_SelectLevel(tile, cameraObject));
+				if (level)
+					visible.push_back({ &tile, level });
 			}
- 		}
 
-		// painting algorith ( from back to front )
-		sort(trianglesToRaster.begin(), trianglesToRaster.end(), [](Triangle& t1, Triangle& t2)
+		// the stand ins hug the surface closely enough to make cheap
+		// occluders, each pushed back by its own error
+		Occlusion_Clear();
+		for (auto& v : visible)
+		{
+			MeshLevel* standIn = v.first->levels[v.first->standIn].mesh.get();
+			if (standIn)
+				Occlusion_RenderOccluders(pass, *standIn, standIn->error);
+		}
+		Occlusion_BuildPyramid();
+		pass.occlusion = true;
+
+		// geometry stage, split into fixed size batches for the worker pool.
+		// Each batch fills its own bin and the bins are stitched together in
+		// batch order, so the result matches a serial pass exactly
+		const int batchSize = 8; // clusters, so about 256 triangles
+		FrameVector<GeometryBatch> batches{ ArenaAllocator<GeometryBatch>(frameArena) };
+		auto addBatches = [&](GeometryPass& levelPass, MeshLevel& level, const float* luminance)
+		{
+			int clusterCount = (int)level.clusters.size();
+			for (int first = 0; first < clusterCount; first += batchSize)
+				batches.push_back({ &levelPass, &level, luminance, first, min(first + batchSize, clusterCount) });
+		};
+
+		for (auto& v : visible)
+			addBatches(pass, *v.second, Mesh_Shading(v.second->shade, *v.second, 0, pass.lightObject));
+
+		// scene objects are culled by their own sphere, the ones left get a
+		// pass of their own with the camera and light brought into the
+		// object's space. Copies face the light every which way, so they're
+		// lit per drawn face straight from the shared corner normals rather
+		// than cached. Reserved up front, the batches point into it
+		FrameVector<SceneObject*> shown{ ArenaAllocator<SceneObject*>(frameArena) };
+		for (auto& object : scene)
+			if (!Sphere_Hidden(object.center, object.radius, pass))
+				shown.push_back(&object);
+
+		FrameVector<GeometryPass> objectPasses{ ArenaAllocator<GeometryPass>(frameArena) };
+		objectPasses.reserve(shown.size());
+		for (SceneObject* shownObject : shown)
+		{
+			SceneObject& object = *shownObject;
+			objectPasses.push_back(pass);
+			GeometryPass& objectPass = objectPasses.back();
+			objectPass.world = Matrix_MultiplyMatrix(object.transform, world);
+			objectPass.worldView = Matrix_MultiplyMatrix(objectPass.world, viewMatrix);
+
+			Matrix objectInverse = Matrix_QuickInverse(objectPass.world);
+			Vector3 objectLight = Matrix_MultiplyVector(objectInverse, light);
+			objectPass.cameraObject = Matrix_MultiplyVector(objectInverse, camera);
+			objectPass.lightObject = Vector3_Normalize(objectLight);
+
+			Mesh& mesh = meshLibrary[object.mesh];
+			int level = Mesh_SelectLevel(mesh, objectPass);
+			addBatches(objectPass, mesh.levels[level], nullptr);
+		}
+
+		int batchCount = (int)batches.size();
+		if ((int)geometryBins.size() < batchCount)
+			geometryBins.resize(batchCount);
+
+		workers.ParallelFor(batchCount, [&](int b)
 			{
-				float z1 = (t1.vertices[0].z + t1.vertices[1].z + t1.vertices[2].z) / 3.0f;
-				float z2 = (t2.vertices[0].z + t2.vertices[1].z + t2.vertices[2].z) / 3.0f;
-				return z1 > z2;
+				geometryBins[b].clear();
+				GeometryBatch& batch = batches[b];
+				Geometry_ProcessBatch(*batch.pass, *batch.level, batch.luminance, batch.first, batch.last, geometryBins[b]);
 			});
 
+		// store triangles for raster
+		size_t rasterCount = 0;
+		for (int b = 0; b < batchCount; ++b)
+			rasterCount += geometryBins[b].size();
+
+		FrameVector<Triangle> trianglesToRaster{ ArenaAllocator<Triangle>(frameArena) };
+		trianglesToRaster.reserve(rasterCount);
+		for (int b = 0; b < batchCount; ++b)
+			trianglesToRaster.insert(trianglesToRaster.end(), geometryBins[b].begin(), geometryBins[b].end());
+
+		// painting algorith ( from back to front ), sort small key/index pairs
+		// instead of whole triangles and read the triangles back through them
+		depthKeys.resize(trianglesToRaster.size());
+		for (size_t i = 0; i < trianglesToRaster.size(); ++i)
+		{
+			depthKeys[i].key = DepthKey_Make(trianglesToRaster[i]);
+			depthKeys[i].index = (uint32_t)i;
+		}
+		DepthKey_RadixSort(depthKeys, depthScratch);
+
 		// clear screen
 		Fill(0, 0, GetScreenWidth(), GetScreenHeight(), Solid, FG_Black);
 
-		// BLACK BOX...
-		for (auto& tri : trianglesToRaster)
+		const float screenRight = (float)GetScreenWidth() - 1.0f;
+		const float screenBottom = (float)GetScreenHeight() - 1.0f;
+
+		for (auto& depth : depthKeys)
 		{
-			// clip triangles against all four screen edges, this could yield
-			// a bunch of triangles, so create a queue that we traverse to 
-			// ensure we only test new triangles generated against planes
-			Triangle clipped[2];
-			std::list<Triangle> cache;
+			Triangle& tri = trianglesToRaster[depth.index];
+			ClipPolygon buffers[2];
+			ClipPolygon* poly = &buffers[0];
+			ClipPolygon* scratch = &buffers[1];
+			for (int k = 0; k < 3; ++k)
+			{
+				poly->vertices[k] = tri.vertices[k];
+				poly->luminance[k] = tri.luminance[k];
+			}
+			poly->count = 3;
 
-			cache.push_back(tri);
-			int newTriangles = 1;
-			for (int p = 0; p < 4; p++)
+			float minX = min(tri.vertices[0].x, min(tri.vertices[1].x, tri.vertices[2].x));
+			float maxX = max(tri.vertices[0].x, max(tri.vertices[1].x, tri.vertices[2].x));
+			float minY = min(tri.vertices[0].y, min(tri.vertices[1].y, tri.vertices[2].y));
+			float maxY = max(tri.vertices[0].y, max(tri.vertices[1].y, tri.vertices[2].y));
+
+			// nothing of it lands on screen
+			if (maxX < 0.0f || minX > screenRight || maxY < 0.0f || minY > screenBottom)
+				continue;
+
+			// only triangles leaving the guard band need clipping, the rest
+			// gets clipped by the rasterizer
+			if (minX < guardMin.x || maxX > guardMax.x || minY < guardMin.y || maxY > guardMax.y)
 			{
-				int trianglesToAdd = 0;
-				while (newTriangles > 0)
+				for (int p = 0; p < 4 && poly->count > 0; ++p)
 				{
-					// take triangle from front of queue
-					Triangle test = cache.front();
-					cache.pop_front();
-					newTriangles--;
-
-					// clip it against a plane. We only need to test each 
-					// subsequent plane, against subsequent new triangles
-					// as all triangles after a plane clip are guaranteed
-					// to lie on the inside of the plane. I like how this
-					// comment is almost completely and utterly justified
-					switch (p)
+					Polygon_ClipAgainstPlane(guardBand[p], *poly, *scratch);
+					std::swap(poly, scratch);
+				}
+			}
+
+			// snap once, every fan triangle then shares its corners exactly
+			int sx[9], sy[9];
+			for (int n = 0; n < poly->count; ++n)
+			{
+				sx[n] = ToSubpixel(poly->vertices[n].x);
+				sy[n] = ToSubpixel(poly->vertices[n].y);
+			}
+
+			for (int n = 1; n + 1 < poly->count; ++n)
+				Raster_ShadedTriangle(sx, sy, poly->luminance, 0, n, n + 1);
+		}
+
+		return true;
+	}
+
+	// Gouraud over the console's 13 levels. Luminance is a plane over the
+	// snapped corners in 1/256 of a level, evaluated once per run of 4 cells
+	// and stepped across it. A 4x4 Bayer threshold added to each cell picks
+	// between the two nearest levels, so gradients come out as patterns
+	// instead of bands. The start is clamped to the ramp and the step to a
+	// level per cell, which keeps slivers with wild gradients inside the
+	// ramp's padding
+	void Raster_ShadedTriangle(const int* sx, const int* sy, const float* luminance, int i0, int i1, int i2)
+	{
+		static const int bayer[4][4] =
+		{
+			{  0,  8,  2, 10 },
+			{ 12,  4, 14,  6 },
+			{  3, 11,  1,  9 },
+			{ 15,  7, 13,  5 },
+		};
+
+		const float one = (float)(1 << SubpixelBits);
+		float x0 = sx[i0] / one, y0 = sy[i0] / one;
+		float x1 = sx[i1] / one - x0, y1 = sy[i1] / one - y0;
+		float x2 = sx[i2] / one - x0, y2 = sy[i2] / one - y0;
+		float area = x1 * y2 - x2 * y1;
+		if (area == 0.0f)
+			return;
+
+		// the -0.5 level turns the dither's round up into GetColor's round down
+		const float scale = 256.0f * RampLevels;
+		float v0 = luminance[i0] * scale - 128.0f;
+		float v1 = luminance[i1] * scale - 128.0f - v0;
+		float v2 = luminance[i2] * scale - 128.0f - v0;
+		float dx = (v1 * y2 - v2 * y1) / area;
+		float dy = (x1 * v2 - x2 * v1) / area;
+		float c = v0 - dx * x0 - dy * y0;
+		int step = (int)max(-256.0f, min(256.0f, dx));
+
+		const CHAR_INFO* levels = ramp + RampPad;
+		const int top = 256 * RampLevels;
+		RasterizeTriangle(sx[i0], sy[i0], sx[i1], sy[i1], sx[i2], sy[i2], 0, 0, GetScreenWidth(), GetScreenHeight(),
+			[&](int x, int y, unsigned mask)
+			{
+				int v = (int)max(0.0f, min((float)top, dx * x + dy * y + c));
+				const int* threshold = bayer[y & 3];
+				CHAR_INFO* cell = &screenBuffer[x + y * GetScreenWidth()];
+				for (int i = 0; i < 4; ++i, v += step)
+					if (mask & (1u << i))
+						cell[i] = levels[(v + threshold[(x + i) & 3] * 16 + 8) >> 8];
+			});
+	}
+
+	// one off conversion of an OBJ into a tile file. A triangle goes to the
+	// tile its centroid is in, and each tile is simplified on its own for its
+	// levels so the tile's open edges stay pinned and neighbours still meet
+	// whatever detail either of them is drawn at. Only the
+	// vertices are held for the whole terrain, the faces are read again for
+	// each run of tile rows and its tiles are written out before the next
+	bool Terrain_Bake(const std::string& objFile, const std::string& tileFile, float size)
+	{
+		std::vector<Vector3> positions;
+		std::vector<Vector3> fileNormals;
+		if (!Mesh::ReadObjVertices(objFile, positions, fileNormals) || positions.empty())
+			return false;
+
+		Vector3 lo = positions[0];
+		Vector3 hi = lo;
+		for (auto& p : positions)
+		{
+			lo = { min(lo.x, p.x), min(lo.y, p.y), min(lo.z, p.z) };
+			hi = { max(hi.x, p.x), max(hi.y, p.y), max(hi.z, p.z) };
+		}
+		float dx = hi.x - lo.x, dy = hi.y - lo.y, dz = hi.z - lo.z;
+		float maxError = occluderError * 0.5f * sqrtf(dx * dx + dy * dy + dz * dz);
+
+		TileFileHeader header{ { 'T', 'E', 'R', '4' } };
+		header.tilesX = max(1, (int)ceilf(dx / size));
+		header.tilesZ = max(1, (int)ceilf(dz / size));
+		header.originX = lo.x;
+		header.originZ = lo.z;
+		header.tileSize = size;
+		Terrain_SourceStamp(objFile, header.sourceSize, header.sourceTime);
+		const int tileCount = header.tilesX * header.tilesZ;
+
+		auto faceValid = [&](const int* v)
+		{
+			return Mesh::ObjIndexValid(v[0], positions) && Mesh::ObjIndexValid(v[1], positions) && Mesh::ObjIndexValid(v[2], positions);
+		};
+		auto tileOf = [&](const int* v)
+		{
+			Vector3& p0 = positions[v[0]];
+			Vector3& p1 = positions[v[1]];
+			Vector3& p2 = positions[v[2]];
+			int tx = (int)(((p0.x + p1.x + p2.x) / 3.0f - lo.x) / size);
+			int tz = (int)(((p0.z + p1.z + p2.z) / 3.0f - lo.z) / size);
+			tx = max(0, min(header.tilesX - 1, tx));
+			tz = max(0, min(header.tilesZ - 1, tz));
+			return tx + tz * header.tilesX;
+		};
+
+		// first read of the faces: normals smoothed over the whole terrain
+		// before it is cut up, so the corners on both sides of a tile seam
+		// get lit the same, and how many triangles each tile gets
+		bool hasNormals = false;
+		std::vector<Vector3> normals(positions.size(), Vector3{ 0.0f, 0.0f, 0.0f, 0.0f });
+		std::vector<Vector3> given(fileNormals.empty() ? 0 : positions.size(), Vector3{ 0.0f, 1.0f, 0.0f, 0.0f });
+		std::vector<size_t> tileTriangles(tileCount);
+		Mesh::ReadObjFaces(objFile, [&](const int* v, const int* vn)
+			{
+				if (!faceValid(v))
+					return;
+
+				Vector3 n = Mesh::FaceNormal(positions[v[0]], positions[v[1]], positions[v[2]]);
+				for (int k = 0; k < 3; ++k)
+				{
+					Vector3& s = normals[v[k]];
+					s = { s.x + n.x, s.y + n.y, s.z + n.z, 0.0f };
+					if (Mesh::ObjIndexValid(vn[k], fileNormals))
 					{
-					case 0:	trianglesToAdd = Triangle_ClipAgainstPlane({ 0.0f, 0.0f, 0.0f }, { 0.0f, 1.0f, 0.0f }, test, clipped[0], clipped[1]); break;
-					case 1:	trianglesToAdd = Triangle_ClipAgainstPlane({ 0.0f, (float)GetScreenHeight() - 1, 0.0f }, { 0.0f, -1.0f, 0.0f }, test, clipped[0], clipped[1]); break;
-					case 2:	trianglesToAdd = Triangle_ClipAgainstPlane({ 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }, test, clipped[0], clipped[1]); break;
-					case 3:	trianglesToAdd = Triangle_ClipAgainstPlane({ (float)GetScreenWidth() - 1, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }, test, clipped[0], clipped[1]); break;
+						given[v[k]] = fileNormals[vn[k]];
+						hasNormals = true;
 					}
+				}
+				++tileTriangles[tileOf(v)];
+			});
+		if (hasNormals)
+			normals.swap(given);
+		else
+			Mesh::Normalise(normals);
+
+		std::ofstream file(tileFile, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+			return false;
+
+		// the header and records are written again once the offsets are known
+		std::vector<TileFileRecord> records(tileCount);
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)records.data(), tileCount * sizeof(TileFileRecord));
+
+		// the three corners, then the normal each corner is lit with
+		auto writeLevel = [&](const std::vector<Vector3>& p, const std::vector<int>& i, const std::vector<Vector3>& n, float error)
+		{
+			TileFileLevel level{ (uint64_t)file.tellp(), (uint32_t)(i.size() / 3), error };
+			std::vector<Vector3> corners;
+			Mesh::AppendCornerNormals(p, i, n, corners);
+			for (size_t f = 0; f + 2 < i.size(); f += 3)
+			{
+				float data[TileTriangleFloats];
+				for (int k = 0; k < 3; ++k)
+				{
+					const Vector3& v = p[i[f + k]];
+					const Vector3& c = corners[f + k];
+					data[k * 3] = v.x; data[k * 3 + 1] = v.y; data[k * 3 + 2] = v.z;
+					data[9 + k * 3] = c.x; data[9 + k * 3 + 1] = c.y; data[9 + k * 3 + 2] = c.z;
+				}
+				file.write((const char*)data, sizeof(data));
+			}
+			return level;
+		};
 
-					// Clipping may yield a variable number of triangles, so
-					// add these new ones to the back of the queue for subsequent
-					// clipping against next planes
-					for (int w = 0; w < trianglesToAdd; w++)
-						cache.push_back(clipped[w]);
+		std::vector<int> remap(positions.size(), -1);
+		auto bakeTile = [&](const std::vector<int>& indices, TileFileRecord& record)
+		{
+			// the tile's own copy of the vertices it uses
+			std::vector<Vector3> local;
+			std::vector<Vector3> localNormals;
+			std::vector<int> localIndices;
+			for (int index : indices)
+			{
+				if (remap[index] < 0)
+				{
+					remap[index] = (int)local.size();
+					local.push_back(positions[index]);
+					localNormals.push_back(normals[index]);
 				}
-				newTriangles = cache.size();
+				localIndices.push_back(remap[index]);
 			}
+			for (int index : indices)
+				remap[index] = -1;
+
+			if (local.empty())
+				return;
 
-			for (auto& t : cache)
+			Vector3 tlo = local[0];
+			Vector3 thi = tlo;
+			for (auto& p : local)
 			{
-				FillTriangle(t.vertices[0].x, t.vertices[0].y,
-							 t.vertices[1].x, t.vertices[1].y,
-							 t.vertices[2].x, t.vertices[2].y,
-							 t.symbol, t.color);
+				tlo = { min(tlo.x, p.x), min(tlo.y, p.y), min(tlo.z, p.z) };
+				thi = { max(thi.x, p.x), max(thi.y, p.y), max(thi.z, p.z) };
 			}
+			record.center[0] = 0.5f * (tlo.x + thi.x);
+			record.center[1] = 0.5f * (tlo.y + thi.y);
+			record.center[2] = 0.5f * (tlo.z + thi.z);
+			for (auto& p : local)
+			{
+				float x = p.x - record.center[0], y = p.y - record.center[1], z = p.z - record.center[2];
+				record.radius = max(record.radius, sqrtf(x * x + y * y + z * z));
+			}
+			record.levels[0] = writeLevel(local, localIndices, localNormals, 0.0f);
+			record.levelCount = 1;
+
+			// halve for each next level while the simplifier gets anywhere.
+			// The simplifier's own error only covers the step from the level
+			// before, so each level is measured against the full surface both
+			// ways instead. The last one still within maxError is the stand in
+			const std::vector<Vector3> full = local;
+			const std::vector<int> fullIndices = localIndices;
+			while (record.levelCount < TileLevels && localIndices.size() / 3 > 2)
+			{
+				size_t triangles = localIndices.size() / 3;
+				Mesh::Simplify(local, localIndices, triangles / 2);
+				if (localIndices.size() / 3 > triangles * 4 / 5)
+					break;
+
+				float error = max(Mesh::HeightGap(full, fullIndices, local, localIndices), Mesh::HeightGap(local, localIndices, full, fullIndices));
+				if (error <= maxError)
+					record.standIn = record.levelCount;
+				record.levels[record.levelCount++] = writeLevel(local, localIndices, localNormals, error);
+			}
+		};
+
+		// as many rows at a time as come to bakeChunk triangles, at least one
+		auto rowTriangles = [&](int z)
+		{
+			size_t count = 0;
+			for (int x = 0; x < header.tilesX; ++x)
+				count += tileTriangles[x + z * header.tilesX];
+			return count;
+		};
+
+		for (int z0 = 0, z1 = 0; z0 < header.tilesZ; z0 = z1)
+		{
+			size_t run = rowTriangles(z0);
+			for (z1 = z0 + 1; z1 < header.tilesZ && run + rowTriangles(z1) <= bakeChunk; ++z1)
+				run += rowTriangles(z1);
+
+			const int first = z0 * header.tilesX;
+			const int last = z1 * header.tilesX;
+			std::vector<std::vector<int>> tileIndices(last - first);
+			Mesh::ReadObjFaces(objFile, [&](const int* v, const int*)
+				{
+					if (!faceValid(v))
+						return;
+
+					int t = tileOf(v);
+					if (t >= first && t < last)
+						tileIndices[t - first].insert(tileIndices[t - first].end(), v, v + 3);
+				});
+
+			for (int t = first; t < last; ++t)
+				bakeTile(tileIndices[t - first], records[t]);
 		}
 
+		file.seekp(0);
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)records.data(), tileCount * sizeof(TileFileRecord));
+		return file.good();
+	}
+
+	// size and last write time of a file, false when it isn't there
+	static bool Terrain_SourceStamp(const std::string& file, uint64_t& size, uint64_t& time)
+	{
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if (!GetFileAttributesExA(file.c_str(), GetFileExInfoStandard, &data))
+			return false;
+
+		size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+		time = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
 		return true;
 	}
 
-	// helper functions ( all below are ugly but intuitive for learning )
-	Vector3 Matrix_MultiplyVector(Matrix& m, Vector3& i) const
+	// false when the stream has failed or the read comes up short, out is
+	// left alone then
+	static bool Tile_ReadTriangles(std::istream& file, uint32_t count, MeshLevel& out)
 	{
-		Vector3 v;
-		v.x = i.x * m.v[0][0] + i.y * m.v[1][0] + i.z * m.v[2][0] + i.w * m.v[3][0];
-		v.y = i.x * m.v[0][1] + i.y * m.v[1][1] + i.z * m.v[2][1] + i.w * m.v[3][1];
-		v.z = i.x * m.v[0][2] + i.y * m.v[1][2] + i.z * m.v[2][2] + i.w * m.v[3][2];
-		v.w = i.x * m.v[0][3] + i.y * m.v[1][3] + i.z * m.v[2][3] + i.w * m.v[3][3];
-		return v;
+		std::vector<float> data(count * TileTriangleFloats);
+		const std::streamsize bytes = (std::streamsize)(data.size() * sizeof(float));
+		if (!file)
+			return false;
+		file.read((char*)data.data(), bytes);
+		if (!file || file.gcount() != bytes)
+			return false;
+
+		out.triangles.resize(count);
+		out.cornerNormals.resize(count * 3);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			const float* f = &data[i * TileTriangleFloats];
+			for (int k = 0; k < 3; ++k)
+			{
+				out.triangles[i].vertices[k] = { f[k * 3], f[k * 3 + 1], f[k * 3 + 2] };
+				out.cornerNormals[i * 3 + k] = { f[9 + k * 3], f[9 + k * 3 + 1], f[9 + k * 3 + 2], 0.0f };
+			}
+		}
+		return true;
 	}
 
-	Matrix Matrix_GetIdentity() const
+	// read the grid and where each tile's levels are, every triangle is left
+	// on disk. A file baked from another version of sourceFile is turned
+	// down so it gets baked again, without the source around it is taken
+	bool Terrain_Open(const std::string& tileFile, const std::string& sourceFile)
 	{
-		Matrix identity;
-		identity.v[0][0] = 1.0f;
-		identity.v[1][1] = 1.0f;
-		identity.v[2][2] = 1.0f;
-		identity.v[3][3] = 1.0f;
-		return identity;
+		std::ifstream file(tileFile, std::ios::binary);
+		if (!file.is_open())
+			return false;
+
+		TileFileHeader header{};
+		file.read((char*)&header, sizeof(header));
+		if (!file || memcmp(header.magic, "TER4", 4) != 0 || header.tilesX <= 0 || header.tilesZ <= 0)
+			return false;
+
+		uint64_t sourceSize{}, sourceTime{};
+		if (Terrain_SourceStamp(sourceFile, sourceSize, sourceTime) && (sourceSize != header.sourceSize || sourceTime != header.sourceTime))
+			return false;
+
+		std::vector<TileFileRecord> records(header.tilesX * header.tilesZ);
+		file.read((char*)records.data(), records.size() * sizeof(TileFileRecord));
+		if (!file)
+			return false;
+
+		tilesX = header.tilesX;
+		tilesZ = header.tilesZ;
+		tileOriginX = header.originX;
+		tileOriginZ = header.originZ;
+		tileSize = header.tileSize;
+
+		tiles.clear();
+		tiles.resize(records.size());
+		residentLevels.clear();
+		terrainBytes = 0;
+		for (size_t t = 0; t < records.size(); ++t)
+		{
+			TerrainTile& tile = tiles[t];
+			tile.center = { records[t].center[0], records[t].center[1], records[t].center[2] };
+			tile.radius = records[t].radius;
+			tile.levelCount = max(0, min(TileLevels, (int)records[t].levelCount));
+			tile.standIn = max(0, min(tile.levelCount - 1, (int)records[t].standIn));
+			for (int l = 0; l < tile.levelCount; ++l)
+			{
+				tile.levels[l].offset = records[t].levels[l].offset;
+				tile.levels[l].count = records[t].levels[l].count;
+				tile.levels[l].error = records[t].levels[l].error;
+			}
+		}
+		return true;
 	}
 
-	Matrix Matrix_GetRotationX(float rad) const
+	// runs beside the game thread, reads the level asked for most urgently
+	// and hands it back ready to draw. Only the request and result lists are
+	// shared, and the lock is never held across the read
+	void Terrain_Loader()
 	{
-		Matrix rotationX;
-		rotationX.v[0][0] = 1.0f;
-		rotationX.v[1][1] = cosf(rad);
-		rotationX.v[1][2] = sinf(rad);
-		rotationX.v[2][1] = -sinf(rad);
-		rotationX.v[2][2] = cosf(rad);
-		rotationX.v[3][3] = 1.0f;
-		return rotationX;
+		std::ifstream file(tilePath, std::ios::binary);
+		while (true)
+		{
+			TileRequest request;
+			{
+				std::unique_lock<std::mutex> lock(tileLock);
+				tileWake.wait(lock, [this] { return tileLoaderQuit || !tileRequests.empty(); });
+				if (tileLoaderQuit)
+					return;
+
+				request = tileRequests.back();
+				tileRequests.pop_back();
+			}
+
+			// a level that can't be read whole goes back empty, the game
+			// thread then does without it rather than drawing a partial one
+			std::unique_ptr<MeshLevel> level(new MeshLevel());
+			file.clear();
+			file.seekg((std::streamoff)request.offset);
+			if (Tile_ReadTriangles(file, request.count, *level))
+				level->BuildClusters();
+			else
+				level.reset();
+
+			std::lock_guard<std::mutex> lock(tileLock);
+			tilesLoaded.push_back({ request, std::move(level) });
+		}
 	}
 
-	Matrix Matrix_GetRotationY(float rad) const
+	void Terrain_StopLoader()
 	{
-		Matrix rotationY;
-		rotationY.v[0][0] = cosf(rad);
-		rotationY.v[0][2] = sinf(rad);
-		rotationY.v[2][0] = -sinf(rad);
-		rotationY.v[1][1] = 1.0f;
-		rotationY.v[2][2] = cosf(rad);
-		rotationY.v[3][3] = 1.0f;
-		return rotationY;
+		if (!tileLoader.joinable())
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(tileLock);
+			tileLoaderQuit = true;
+		}
+		tileWake.notify_one();
+		tileLoader.join();
 	}
 
-	Matrix Matrix_GetRotationZ(float rad) const
+	// what a level costs once resident, counted up front so requests in
+	// flight are already inside the budget
+	size_t Terrain_TileBytes(uint32_t count) const
 	{
-		Matrix rotationZ;
-		rotationZ.v[0][0] = cosf(rad);
-		rotationZ.v[0][1] = sinf(rad);
-		rotationZ.v[1][0] = -sinf(rad);
-		rotationZ.v[1][1] = cosf(rad);
-		rotationZ.v[2][2] = 1.0f;
-		rotationZ.v[3][3] = 1.0f;
-		return rotationZ;
+		return count * (sizeof(Triangle) + 4 * sizeof(Vector3) + 3 * sizeof(float) + sizeof(MeshCluster));
 	}
 
-	Matrix Matrix_GetTranslation(float x, float y, float z) const
+	float Tile_Distance(const TerrainTile& tile, const Vector3& cameraObject) const
 	{
-		Matrix translation;
-		translation.v[0][0] = 1.0f;
-		translation.v[1][1] = 1.0f;
-		translation.v[2][2] = 1.0f;
-		translation.v[3][3] = 1.0f;
-		translation.v[3][0] = x;
-		translation.v[3][1] = y;
-		translation.v[3][2] = z;
-		return translation;
+		float x = tile.center.x - cameraObject.x, y = tile.center.y - cameraObject.y, z = tile.center.z - cameraObject.z;
+		return sqrtf(x * x + y * y + z * z) - tile.radius;
 	}
 
-	Matrix Matrix_GetProjection(float fov, float ratio, float eyeNear, float eyeFar) const
+	// the tiles [x0, x1] x [z0, z1] that can come within radius of the
+	// camera. Tiles may poke a little out of their square, so one further
+	// all round. Comes out empty when the camera is that far off the grid
+	void Terrain_Window(const Vector3& cameraObject, float radius, int& x0, int& z0, int& x1, int& z1) const
 	{
-		float fFovRad = 1.0f / tanf(fov * 0.5f / 180.0f * 3.14159f);
-		Matrix projection;
-		projection.v[0][0] = ratio * fFovRad;
-		projection.v[1][1] = fFovRad;
-		projection.v[2][2] = eyeFar / (eyeFar - eyeNear);
-		projection.v[3][2] = (-eyeFar * eyeNear) / (eyeFar - eyeNear);
-		projection.v[2][3] = 1.0f;
-		projection.v[3][3] = 0.0f;
-		return projection;
+		x0 = max(0, (int)floorf((cameraObject.x - radius - tileOriginX) / tileSize) - 1);
+		z0 = max(0, (int)floorf((cameraObject.z - radius - tileOriginZ) / tileSize) - 1);
+		x1 = min(tilesX - 1, (int)floorf((cameraObject.x + radius - tileOriginX) / tileSize) + 1);
+		z1 = min(tilesZ - 1, (int)floorf((cameraObject.z + radius - tileOriginZ) / tileSize) + 1);
+	}
+
+	// the coarsest of the tile's levels whose error still projects under
+	// lodErrorCells, as for scene objects
+	int Tile_SelectLevel(const TerrainTile& tile, const Vector3& cameraObject)
+	{
+		float distance = Tile_Distance(tile, cameraObject);
+		if (distance <= 0.1f)
+			return 0;
+
+		float cellsPerUnit = Lod_CellsPerUnit(distance);
+		for (int i = tile.levelCount - 1; i > 0; --i)
+			if (tile.levels[i].error * cellsPerUnit <= lodErrorCells)
+				return i;
+		return 0;
 	}
 
-	Matrix Matrix_MultiplyMatrix(Matrix& m1, Matrix& m2) const
+	// the level asked for once it has come in, until then the stand in or
+	// failing that whichever resident level is nearest in detail. Null
+	// while the tile has nothing resident
+	MeshLevel* Tile_DrawLevel(TerrainTile& tile, int level)
 	{
-		Matrix matrix;
-		for (int c = 0; c < 4; c++)
-			for (int r = 0; r < 4; r++)
-				matrix.v[r][c] = m1.v[r][0] * m2.v[0][c] + m1.v[r][1] * m2.v[1][c] + 
-								 m1.v[r][2] * m2.v[2][c] + m1.v[r][3] * m2.v[3][c];
-		return matrix;
+		if (tile.levels[level].mesh)
+			return tile.levels[level].mesh.get();
+		if (tile.levels[tile.standIn].mesh)
+			return tile.levels[tile.standIn].mesh.get();
+
+		for (int step = 1; step < tile.levelCount; ++step)
+		{
+			if (level - step >= 0 && tile.levels[level - step].mesh)
+				return tile.levels[level - step].mesh.get();
+			if (level + step < tile.levelCount && tile.levels[level + step].mesh)
+				return tile.levels[level + step].mesh.get();
+		}
+		return nullptr;
 	}
 
-	Matrix Matrix_PointAt(Vector3& pos, Vector3& target, Vector3& up) const
+	// take in what the loader finished and queue up what is missing around
+	// the camera. Never waits on the loader, when it holds the lock this is
+	// simply tried again next frame. Returns true when the levels changed
+	bool Terrain_Update(const Vector3& cameraObject)
 	{
-		// calculate new forward direction
-		Vector3 newForward = Vector3_Sub(target, pos);
-		newForward = Vector3_Normalize(newForward);
+		std::unique_lock<std::mutex> lock(tileLock, std::try_to_lock);
+		if (!lock.owns_lock())
+			return false;
+
+		++terrainFrame;
+		bool changed = !tilesLoaded.empty();
+		for (auto& loaded : tilesLoaded)
+		{
+			TileLevel& level = tiles[loaded.first.tile].levels[loaded.first.level];
+			level.queued = false;
+			if (!loaded.second)
+			{
+				// not asked for again, the file won't have changed
+				level.broken = true;
+				terrainBytes -= Terrain_TileBytes(level.count);
+				continue;
+			}
 
-		// calculate new Up direction
-		Vector3 a = Vector3_Mul(newForward, Vector3_DotProduct(up, newForward));
-		Vector3 newUp = Vector3_Sub(up, a);
-		newUp = Vector3_Normalize(newUp);
+			level.mesh = std::move(loaded.second);
+			level.mesh->error = level.error;
+			residentLevels.push_back({ loaded.first.tile, loaded.first.level });
+		}
+		tilesLoaded.clear();
+
+		// whatever the loader hasn't started on is asked for again from
+		// scratch, so a moving camera leaves no trail of stale requests
+		for (auto& request : tileRequests)
+		{
+			tiles[request.tile].levels[request.level].queued = false;
+			terrainBytes -= Terrain_TileBytes(request.count);
+		}
+		tileRequests.clear();
 
-		// new Right direction is easy, its just cross product
-		Vector3 newRight = Vector3_CrossProduct(newUp, newForward);
+		// every tile in view wants its stand in and the level picked for its
+		// distance. Stand ins go first so the picture has no holes for long,
+		// then the rest nearest first
+		int x0, z0, x1, z1;
+		Terrain_Window(cameraObject, viewRadius, x0, z0, x1, z1);
 
-		// construct Dimensioning and Translation Matrix	
-		Matrix matrix;
-		matrix.v[0][0] = newRight.x;	matrix.v[0][1] = newRight.y;	matrix.v[0][2] = newRight.z;	matrix.v[0][3] = 0.0f;
-		matrix.v[1][0] = newUp.x;		matrix.v[1][1] = newUp.y;		matrix.v[1][2] = newUp.z;		matrix.v[1][3] = 0.0f;
-		matrix.v[2][0] = newForward.x;	matrix.v[2][1] = newForward.y;	matrix.v[2][2] = newForward.z;	matrix.v[2][3] = 0.0f;
-		matrix.v[3][0] = pos.x;			matrix.v[3][1] = pos.y;			matrix.v[3][2] = pos.z;			matrix.v[3][3] = 1.0f;
-		return matrix;
+		FrameVector<WantedLevel> wanted{ ArenaAllocator<WantedLevel>(frameArena) };
+		for (int z = z0; z <= z1; ++z)
+			for (int x = x0; x <= x1; ++x)
+			{
+				TerrainTile& tile = tiles[x + z * tilesX];
+				float distance = Tile_Distance(tile, cameraObject);
+				if (tile.levels[0].count == 0 || distance >= viewRadius)
+					continue;
+
+				int level = Tile_SelectLevel(tile, cameraObject);
+				tile.levels[tile.standIn].lastUsed = terrainFrame;
+				tile.levels[level].lastUsed = terrainFrame;
+				wanted.push_back({ true, distance, x + z * tilesX, tile.standIn });
+				if (level != tile.standIn)
+					wanted.push_back({ false, distance, x + z * tilesX, level });
+			}
+		std::sort(wanted.begin(), wanted.end(), [](const WantedLevel& a, const WantedLevel& b)
+			{
+				return a.standIn != b.standIn ? a.standIn : a.distance < b.distance;
+			});
+
+		for (auto& w : wanted)
+		{
+			TileLevel& level = tiles[w.tile].levels[w.level];
+			if (level.mesh || level.queued || level.broken)
+				continue;
+
+			size_t bytes = Terrain_TileBytes(level.count);
+			while (terrainBytes + bytes > terrainBudget && Terrain_EvictOne())
+				changed = true;
+			if (terrainBytes + bytes > terrainBudget)
+				break;
+
+			terrainBytes += bytes;
+			level.queued = true;
+			tileRequests.push_back({ w.tile, w.level, level.offset, level.count });
+		}
+
+		// the loader takes from the back
+		std::reverse(tileRequests.begin(), tileRequests.end());
+		if (!tileRequests.empty())
+			tileWake.notify_one();
+
+		return changed;
 	}
 
-	Matrix Matrix_QuickInverse(Matrix& m) const // Only for Rotation/Translation Matrices
+	// drop whichever resident level went unused the longest, levels wanted
+	// this frame are never picked. That leaves levels the tiles have moved
+	// on from and tiles out of view, so evicting hardly changes the picture
+	bool Terrain_EvictOne()
 	{
-		Matrix inverse;
-		inverse.v[0][0] = m.v[0][0]; inverse.v[0][1] = m.v[1][0]; inverse.v[0][2] = m.v[2][0]; inverse.v[0][3] = 0.0f;
-		inverse.v[1][0] = m.v[0][1]; inverse.v[1][1] = m.v[1][1]; inverse.v[1][2] = m.v[2][1]; inverse.v[1][3] = 0.0f;
-		inverse.v[2][0] = m.v[0][2]; inverse.v[2][1] = m.v[1][2]; inverse.v[2][2] = m.v[2][2]; inverse.v[2][3] = 0.0f;
-		inverse.v[3][0] = -(m.v[3][0] * inverse.v[0][0] + m.v[3][1] * inverse.v[1][0] + m.v[3][2] * inverse.v[2][0]);
-		inverse.v[3][1] = -(m.v[3][0] * inverse.v[0][1] + m.v[3][1] * inverse.v[1][1] + m.v[3][2] * inverse.v[2][1]);
-		inverse.v[3][2] = -(m.v[3][0] * inverse.v[0][2] + m.v[3][1] * inverse.v[1][2] + m.v[3][2] * inverse.v[2][2]);
-		inverse.v[3][3] = 1.0f;
-		return inverse;
+		int oldest = -1;
+		for (int i = 0; i < (int)residentLevels.size(); ++i)
+		{
+			const TileLevel& level = tiles[residentLevels[i].first].levels[residentLevels[i].second];
+			if (level.lastUsed != terrainFrame && (oldest < 0 || level.lastUsed < tiles[residentLevels[oldest].first].levels[residentLevels[oldest].second].lastUsed))
+				oldest = i;
+		}
+		if (oldest < 0)
+			return false;
+
+		TileLevel& level = tiles[residentLevels[oldest].first].levels[residentLevels[oldest].second];
+		level.mesh.reset();
+		terrainBytes -= Terrain_TileBytes(level.count);
+		residentLevels[oldest] = residentLevels.back();
+		residentLevels.pop_back();
+		return true;
 	}
 
-	Vector3 Vector3_Add(Vector3& v1, Vector3& v2) const
+	// pick the coarsest level whose error still projects under a cell, going
+	// by the nearest point of the bounding sphere. Camera inside the sphere
+	// always gets full detail
+	int Mesh_SelectLevel(Mesh& mesh, GeometryPass& pass)
 	{
-		return { v1.x + v2.x, v1.y + v2.y, v1.z + v2.z };
+		Vector3 center = Matrix_MultiplyVector(pass.world, mesh.center);
+		Vector3 toCenter = Vector3_Sub(center, pass.camera);
+		float distance = Vector3_Length(toCenter) - mesh.radius;
+		if (distance <= 0.1f)
+			return 0;
+
+		float cellsPerUnit = Lod_CellsPerUnit(distance);
+		for (int i = (int)mesh.levels.size() - 1; i > 0; --i)
+			if (mesh.levels[i].error * cellsPerUnit <= lodErrorCells)
+				return i;
+		return 0;
 	}
 
-	Vector3 Vector3_Sub(Vector3& v1, Vector3& v2) const
+	// how many cells tall one unit looks at distance
+	float Lod_CellsPerUnit(float distance) const
 	{
-		return { v1.x - v2.x, v1.y - v2.y, v1.z - v2.z };
+		return projection.v[1][1] * 0.5f * (float)GetScreenHeight() / distance;
 	}
 
-	Vector3 Vector3_Mul(Vector3& v1, float scale) const
+	// lighting only depends on the light's direction in the owner's space, so
+	// the corner luminances hold while it just moves or the camera does. Only
+	// for levels with one owner, levelIndex tells the owner's levels apart
+	const float* Mesh_Shading(ShadeCache& cache, const MeshLevel& level, int levelIndex, const Vector3& lightObject)
 	{
-		return { v1.x * scale, v1.y * scale, v1.z * scale };
+		if (cache.level != levelIndex || cache.luminance.size() != level.cornerNormals.size() ||
+			memcmp(&cache.light, &lightObject, sizeof(Vector3)) != 0)
+		{
+			cache.luminance.resize(level.cornerNormals.size());
+			for (size_t i = 0; i < level.cornerNormals.size(); ++i)
+				cache.luminance[i] = Corner_Luminance(lightObject, level.cornerNormals[i]);
+			cache.light = lightObject;
+			cache.level = levelIndex;
+		}
+
+		return cache.luminance.data();
 	}
 
-	Vector3 Vector3_Div(Vector3& v1, float scale) const
+	float Corner_Luminance(const Vector3& lightObject, const Vector3& normal)
 	{
-		return { v1.x / scale, v1.y / scale, v1.z / scale };
+		// how aligned
+		return max(0.1f, Vector3_DotProduct(lightObject, normal));
 	}
 
-	float Vector3_DotProduct(Vector3& v1, Vector3& v2) const
+	int Scene_AddMesh(Mesh&& mesh)
 	{
-		return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
+		meshLibrary.push_back(std::move(mesh));
+		return (int)meshLibrary.size() - 1;
 	}
 
-	float Vector3_Length(Vector3& v) const
+	// the sphere keeps the mesh's radius and the object's pass undoes the
+	// transform with Matrix_QuickInverse, so a scaled transform would be
+	// culled and lit wrong. Scale the mesh instead
+	void Scene_Add(int mesh, Matrix& transform)
 	{
-		return sqrtf(Vector3_DotProduct(v, v));
+		for (int r = 0; r < 3; ++r)
+		{
+			float lengthSq = transform.v[r][0] * transform.v[r][0] + transform.v[r][1] * transform.v[r][1] + transform.v[r][2] * transform.v[r][2];
+			assert(fabsf(lengthSq - 1.0f) < 1e-3f && "scene transforms must be rigid");
+			(void)lengthSq;
+		}
+
+		SceneObject object;
+		object.mesh = mesh;
+		object.transform = transform;
+		object.center = Matrix_MultiplyVector(transform, meshLibrary[mesh].center);
+		object.radius = meshLibrary[mesh].radius;
+		scene.push_back(object);
+
+		// the picture on screen no longer has everything in it
+		lastFrameValid = false;
 	}
 
-	Vector3 Vector3_Normalize(Vector3& v) const
+	// drop copies of a mesh at random spots on the terrain, turned about y.
+	// Heights come from the tiles' stand ins, those stray from the full surface
+	// by half a unit on average, so the objects are sunk in a bit
+	void Scene_Scatter(int mesh, int count)
 	{
-		float l = Vector3_Length(v);
-		return { v.x / l, v.y / l, v.z / l };
+		std::ifstream file(tilePath, std::ios::binary);
+		for (int i = 0; i < count; ++i)
+		{
+			float x = tileOriginX + tilesX * tileSize * (rand() / (float)RAND_MAX);
+			float z = tileOriginZ + tilesZ * tileSize * (rand() / (float)RAND_MAX);
+			float turn = 6.2831853f * (rand() / (float)RAND_MAX);
+			float y{};
+			if (!Terrain_Height(file, x, z, y))
+				continue;
+
+			Matrix rotation = Matrix_GetRotationY(turn);
+			Matrix translation = Matrix_GetTranslation(x, y - 0.5f, z);
+			Matrix transform = Matrix_MultiplyMatrix(rotation, translation);
+			Scene_Add(mesh, transform);
+		}
 	}
 
-	Vector3 Vector3_CrossProduct(Vector3& v1, Vector3& v2) const
+	// highest point of the tiles' stand ins straight above or below x, z, read
+	// from the tile file as the tiles needn't be resident. Triangles belong
+	// to the tile holding their centroid, so the ones around it are searched too
+	bool Terrain_Height(std::istream& file, float x, float z, float& height)
 	{
-		Vector3 cp;
-		cp.x = v1.y * v2.z - v1.z * v2.y;
-		cp.y = v1.z * v2.x - v1.x * v2.z;
-		cp.z = v1.x * v2.y - v1.y * v2.x;
-		return cp;
+		int tx = (int)floorf((x - tileOriginX) / tileSize);
+		int tz = (int)floorf((z - tileOriginZ) / tileSize);
+		bool found = false;
+
+		MeshLevel coarse;
+		for (int nz = max(0, tz - 1); nz <= min(tilesZ - 1, tz + 1); ++nz)
+			for (int nx = max(0, tx - 1); nx <= min(tilesX - 1, tx + 1); ++nx)
+			{
+				const TerrainTile& tile = tiles[nx + nz * tilesX];
+				const TileLevel& level = tile.levels[tile.standIn];
+				file.clear();
+				file.seekg((std::streamoff)level.offset);
+				if (level.count == 0 || !Tile_ReadTriangles(file, level.count, coarse))
+					continue;
+
+				for (auto& tri : coarse.triangles)
+				{
+					float y;
+					if (!Mesh::HeightAt(tri.vertices[0], tri.vertices[1], tri.vertices[2], x, z, y))
+						continue;
+
+					height = found ? max(height, y) : y;
+					found = true;
+				}
+			}
+
+		return found;
 	}
 
-	// clipping... yeah just treat it as a black box right now...
-	Vector3 Vector_IntersectPlane(Vector3& plane_p, Vector3& plane_n, Vector3& lineStart, Vector3& lineEnd) const
+	// every face of the cluster points away from the camera. Any face whose
+	// normal is inside the cone is back facing as long as the direction to
+	// it stays within 90 degrees minus the spread of the axis, the sphere
+	// bounds how much that direction can swing across the cluster
+	bool Cluster_FacesAway(const MeshCluster& cluster, const Vector3& cameraObject) const
 	{
-		plane_n = Vector3_Normalize(plane_n);
-		float plane_d = -Vector3_DotProduct(plane_n, plane_p);
-		float ad = Vector3_DotProduct(lineStart, plane_n);
-		float bd = Vector3_DotProduct(lineEnd, plane_n);
-		float t = (-plane_d - ad) / (bd - ad);
-		Vector3 lineStartToEnd = Vector3_Sub(lineEnd, lineStart);
-		Vector3 lineToIntersect = Vector3_Mul(lineStartToEnd, t);
-		return Vector3_Add(lineStart, lineToIntersect);
+		if (cluster.cutoff >= 1.0f)
+			return false;
+
+		Vector3 d{ cluster.center.x - cameraObject.x, cluster.center.y - cameraObject.y, cluster.center.z - cameraObject.z };
+		float along = d.x * cluster.axis.x + d.y * cluster.axis.y + d.z * cluster.axis.z;
+		float distance = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z);
+		return along - cluster.radius >= cluster.cutoff * (distance + cluster.radius);
 	}
 
-	int Triangle_ClipAgainstPlane(Vector3 plane_p, Vector3 plane_n, Triangle& in_tri, Triangle& out_tri1, Triangle& out_tri2) const
+	// world -> view -> screen for clusters [first, last), touches nothing but
+	// the pass and out so batches can run side by side
+	void Geometry_ProcessBatch(GeometryPass& pass, MeshLevel& level, const float* luminance, int first, int last, std::vector<Triangle>& out)
 	{
-		// make sure plane normal is indeed normal
-		plane_n = Vector3_Normalize(plane_n);
+		for (int c = first; c < last; ++c)
+		{
+			const MeshCluster& cluster = level.clusters[c];
+			if (Cluster_FacesAway(cluster, pass.cameraObject) || Sphere_Hidden(cluster.center, cluster.radius, pass))
+				continue;
 
-		// return signed shortest distance from point to plane, plane normal must be normalised
-		auto dist = [&](Vector3& p)
+			for (int i = cluster.first; i < cluster.first + cluster.count; ++i)
+				Geometry_ProcessTriangle(pass, level.triangles[i], level.normals[i],
+					luminance ? &luminance[i * 3] : nullptr, &level.cornerNormals[i * 3], out);
+		}
+	}
+
+	// corners is only looked at when there's no luminance to hand, and then
+	// only for faces that turned out to be drawn
+	void Geometry_ProcessTriangle(GeometryPass& pass, Triangle& tri, Vector3& normal, const float* luminance, const Vector3* corners, std::vector<Triangle>& out)
+	{
+		// ray from camera to triangle, both in object space
+		Vector3 ray = Vector3_Sub(tri.vertices[0], pass.cameraObject);
+
+		// only draw the triangles when ray is aligned with normal
+		if (Vector3_DotProduct(normal, ray) >= 0.0f)
+			return;
+
+		// object space -> view space, clip triangles against near
+		Triangle projected{};
+		ClipPolygon source{}, clipped{};
+		Matrix_MultiplyVectors(pass.worldView, tri.vertices, source.vertices, 3);
+		for (int k = 0; k < 3; ++k)
+			source.luminance[k] = luminance ? luminance[k] : Corner_Luminance(pass.lightObject, corners[k]);
+		source.count = 3;
+		Polygon_ClipAgainstPlane(nearPlane, source, clipped);
+
+		// project when multiple triangles form the clip
+		for (int n = 1; n + 1 < clipped.count; ++n)
 		{
-			Vector3 n = Vector3_Normalize(p);
-			return (plane_n.x * p.x + plane_n.y * p.y + plane_n.z * p.z - Vector3_DotProduct(plane_n, plane_p));
-		};
+			// project triangles from 3D --> 2D
+			projected.vertices[0] = Project_ToScreen(pass, clipped.vertices[0]);
+			projected.vertices[1] = Project_ToScreen(pass, clipped.vertices[n]);
+			projected.vertices[2] = Project_ToScreen(pass, clipped.vertices[n + 1]);
+			projected.luminance[0] = clipped.luminance[0];
+			projected.luminance[1] = clipped.luminance[n];
+			projected.luminance[2] = clipped.luminance[n + 1];
+
+			// store triangle for sorting
+			out.push_back(projected);
+		}
+	}
+
+	// view space -> screen cells, z comes out as depth in [0, 1] between the
+	// near and far planes
+	Vector3 Project_ToScreen(GeometryPass& pass, Vector3& viewed)
+	{
+		Vector3 p = Matrix_MultiplyVector(pass.projection, viewed);
+
+		// scale into view, we moved the normalising into cartesian space
+		// out of the matrix.vector function from the previous videos, so
+		// do this manually
+		p = Vector3_Div(p, p.w);
+
+		// X/Y are inverted so put them back, then offset into visible
+		// normalised space and scale up to the screen
+		p.x = (1.0f - p.x) * 0.5f * (float)GetScreenWidth();
+		p.y = (1.0f - p.y) * 0.5f * (float)GetScreenHeight();
+		return p;
+	}
 
-		// create two temporary storage arrays to classify points either side of plane
-		// if distance sign is positive, point lies on "inside" of plane
-		Vector3* inside_points[3];  int nInsidePointCount = 0;
-		Vector3* outside_points[3]; int nOutsidePointCount = 0;
+	// same depth Project_ToScreen produces, for a bare view space z
+	float Project_Depth(GeometryPass& pass, float viewZ) const
+	{
+		return (pass.projection.v[2][2] * viewZ + pass.projection.v[3][2]) / viewZ;
+	}
 
-		// get signed distance of each point in triangle to plane
-		float d0 = dist(in_tri.vertices[0]);
-		float d1 = dist(in_tri.vertices[1]);
-		float d2 = dist(in_tri.vertices[2]);
+	// start the frame's depth pyramid with nothing in the way
+	void Occlusion_Clear()
+	{
+		if (depthPyramid.empty())
+		{
+			for (int lw = GetScreenWidth(), lh = GetScreenHeight(); ; lw = (lw + 1) / 2, lh = (lh + 1) / 2)
+			{
+				depthPyramid.push_back({ lw, lh, std::vector<float>(lw * lh) });
+				if (lw == 1 && lh == 1)
+					break;
+			}
+		}
 
-		if (d0 >= 0) { inside_points[nInsidePointCount++] = &in_tri.vertices[0]; }
-		else { outside_points[nOutsidePointCount++] = &in_tri.vertices[0]; }
-		if (d1 >= 0) { inside_points[nInsidePointCount++] = &in_tri.vertices[1]; }
-		else { outside_points[nOutsidePointCount++] = &in_tri.vertices[1]; }
-		if (d2 >= 0) { inside_points[nInsidePointCount++] = &in_tri.vertices[2]; }
-		else { outside_points[nOutsidePointCount++] = &in_tri.vertices[2]; }
+		std::vector<float>& depth = depthPyramid[0].depth;
+		std::fill(depth.begin(), depth.end(), 1.0f);
+	}
 
-		// now classify triangle points, and break the input triangle into 
-		// smaller output triangles if required. There are four possible
-		// outcomes...
+	// depth only pass over a coarse level of the mesh, keeping the nearest
+	// occluder per cell. The coarse surface may sit up to pad in front of the
+	// real one, so it is pushed back by that much to stay conservative.
+	// Triangles touching the near plane are simply left out
+	void Occlusion_RenderOccluders(GeometryPass& pass, MeshLevel& occluders, float pad)
+	{
+		const int w = GetScreenWidth();
+		const int h = GetScreenHeight();
+		std::vector<float>& depth = depthPyramid[0].depth;
 
-		if (nInsidePointCount == 0)
+		for (size_t i = 0; i < occluders.triangles.size(); ++i)
 		{
-			// all points lie on the outside of plane, so clip whole triangle
-			// It ceases to exist
+			Triangle& tri = occluders.triangles[i];
+			Vector3 ray = Vector3_Sub(tri.vertices[0], pass.cameraObject);
+			if (Vector3_DotProduct(occluders.normals[i], ray) >= 0.0f)
+				continue;
+
+			Vector3 viewed[3], screen[3];
+			Matrix_MultiplyVectors(pass.worldView, tri.vertices, viewed, 3);
+			bool nearby = false;
+			for (int k = 0; k < 3; ++k)
+			{
+				nearby |= viewed[k].z <= nearPlane.d;
+				screen[k] = Project_ToScreen(pass, viewed[k]);
+				screen[k].z = Project_Depth(pass, viewed[k].z + pad);
+			}
+			if (nearby)
+				continue;
+
+			// anything reaching past the guard band is left out as well, it
+			// would not fit the rasterizer's fixed point
+			float minX = min(screen[0].x, min(screen[1].x, screen[2].x));
+			float maxX = max(screen[0].x, max(screen[1].x, screen[2].x));
+			float minY = min(screen[0].y, min(screen[1].y, screen[2].y));
+			float maxY = max(screen[0].y, max(screen[1].y, screen[2].y));
+			if (minX < guardMin.x || maxX > guardMax.x || minY < guardMin.y || maxY > guardMax.y)
+				continue;
+
+			// depth is affine across the screen, so it can be stepped along a
+			// run from cell centre to cell centre. Keep it from extrapolating
+			// nearer than the nearest corner where the snapped coverage pokes out
+			float x01 = screen[1].x - screen[0].x, y01 = screen[1].y - screen[0].y, z01 = screen[1].z - screen[0].z;
+			float x02 = screen[2].x - screen[0].x, y02 = screen[2].y - screen[0].y, z02 = screen[2].z - screen[0].z;
+			float denom = x01 * y02 - x02 * y01;
+			if (fabsf(denom) < 1e-6f)
+				continue;
+
+			float dzdx = (z01 * y02 - z02 * y01) / denom;
+			float dzdy = (x01 * z02 - x02 * z01) / denom;
+			float z0 = screen[0].z - dzdx * (screen[0].x - 0.5f) - dzdy * (screen[0].y - 0.5f);
+			float nearest = min(screen[0].z, min(screen[1].z, screen[2].z));
+
+			RasterizeTriangle(
+				ToSubpixel(screen[0].x), ToSubpixel(screen[0].y), ToSubpixel(screen[1].x), ToSubpixel(screen[1].y),
+				ToSubpixel(screen[2].x), ToSubpixel(screen[2].y),
+				0, 0, w, h,
+				[&](int x, int y, unsigned mask)
+				{
+					float* cell = &depth[x + y * w];
+					float z = z0 + dzdx * x + dzdy * y;
+					for (int c = 0; c < 4; ++c, z += dzdx)
+					{
+						float d = max(z, nearest);
+						if ((mask & (1u << c)) && d < cell[c])
+							cell[c] = d;
+					}
+				});
+		}
+	}
 
-			return 0; // No returned triangles are valid
+	// every coarser texel keeps the farthest of the four below it
+	void Occlusion_BuildPyramid()
+	{
+		for (size_t l = 1; l < depthPyramid.size(); ++l)
+		{
+			const DepthLevel& fine = depthPyramid[l - 1];
+			DepthLevel& coarse = depthPyramid[l];
+			for (int y = 0; y < coarse.height; ++y)
+			{
+				int y0 = y * 2;
+				int y1 = min(y0 + 1, fine.height - 1);
+				for (int x = 0; x < coarse.width; ++x)
+				{
+					int x0 = x * 2;
+					int x1 = min(x0 + 1, fine.width - 1);
+					coarse.depth[x + y * coarse.width] = max(
+						max(fine.depth[x0 + y0 * fine.width], fine.depth[x1 + y0 * fine.width]),
+						max(fine.depth[x0 + y1 * fine.width], fine.depth[x1 + y1 * fine.width]));
+				}
+			}
 		}
+	}
 
-		if (nInsidePointCount == 3)
+	// an object space sphere is behind the camera or off screen altogether,
+	// or once the pyramid is filled, behind the occluders everywhere it could
+	// land on screen. The sphere is boxed in view space and the box corners
+	// projected, then the pyramid level where that rect spans at most a
+	// couple of texels is checked
+	bool Sphere_Hidden(const Vector3& objectCenter, float r, GeometryPass& pass)
+	{
+		Vector3 center = objectCenter;
+		Vector3 c = Matrix_MultiplyVector(pass.worldView, center);
+		if (c.z + r < nearPlane.d)
+			return true;
+		if (c.z - r <= nearPlane.d)
+			return false;
+
+		float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+		for (int k = 0; k < 8; ++k)
 		{
-			// all points lie on the inside of plane, so do nothing
-			// and allow the triangle to simply pass through
-			out_tri1 = in_tri;
+			Vector3 corner{ c.x + (k & 1 ? r : -r), c.y + (k & 2 ? r : -r), c.z + (k & 4 ? r : -r) };
+			Vector3 p = Project_ToScreen(pass, corner);
+			minX = min(minX, p.x);
+			maxX = max(maxX, p.x);
+			minY = min(minY, p.y);
+			maxY = max(maxY, p.y);
+		}
 
-			return 1; // Just the one returned original triangle is valid
+		if (maxX < 0.0f || maxY < 0.0f || minX >= (float)GetScreenWidth() || minY >= (float)GetScreenHeight())
+			return true;
+		if (!pass.occlusion)
+			return false;
+
+		const DepthLevel& base = depthPyramid[0];
+		int x0 = max(0, (int)minX - 1);
+		int y0 = max(0, (int)minY - 1);
+		int x1 = min(base.width - 1, (int)maxX + 1);
+		int y1 = min(base.height - 1, (int)maxY + 1);
+
+		size_t l = 0;
+		while (l + 1 < depthPyramid.size() && max(x1 - x0, y1 - y0) > 2)
+		{
+			x0 >>= 1; y0 >>= 1; x1 >>= 1; y1 >>= 1;
+			++l;
 		}
 
-		if (nInsidePointCount == 1 && nOutsidePointCount == 2)
+		const DepthLevel& level = depthPyramid[l];
+		float farthest = 0.0f;
+		for (int y = y0; y <= y1; ++y)
+			for (int x = x0; x <= x1; ++x)
+				farthest = max(farthest, level.depth[x + y * level.width]);
+
+		return Project_Depth(pass, c.z - r) > farthest;
+	}
+
+	// far triangles need the smallest keys. Only the ordering matters, so skip
+	// the divide by three, and a positive float's bits already sort like the
+	// float itself, flipping them puts the farthest first
+	uint32_t DepthKey_Make(const Triangle& tri) const
+	{
+		float z = tri.vertices[0].z + tri.vertices[1].z + tri.vertices[2].z;
+		if (!(z > 0.0f))
+			z = 0.0f;
+
+		uint32_t bits{};
+		memcpy(&bits, &z, sizeof(bits));
+		return ~bits;
+	}
+
+	// LSD radix sort, a byte per pass. Stable, so equal depths keep the order
+	// the geometry stage produced them in. Scratch is kept around between frames
+	void DepthKey_RadixSort(std::vector<DepthKey>& keys, std::vector<DepthKey>& scratch) const
+	{
+		size_t count = keys.size();
+		scratch.resize(count);
+
+		DepthKey* src = keys.data();
+		DepthKey* dst = scratch.data();
+
+		for (int shift = 0; shift < 32; shift += 8)
 		{
-			// triangle should be clipped. As two points lie outside
-			// the plane, the triangle simply becomes a smaller triangle
+			size_t offsets[256]{};
+			for (size_t i = 0; i < count; ++i)
+				++offsets[(src[i].key >> shift) & 0xFF];
 
-			// topy appearance info to new triangle
-			out_tri1.color = in_tri.color;
-			out_tri1.symbol = in_tri.symbol;
+			// every key shares this byte, nothing would move
+			if (count == 0 || offsets[(src[0].key >> shift) & 0xFF] == count)
+				continue;
 
-			// the inside point is valid, so keep that...
-			out_tri1.vertices[0] = *inside_points[0];
+			size_t sum = 0;
+			for (int b = 0; b < 256; ++b)
+			{
+				size_t n = offsets[b];
+				offsets[b] = sum;
+				sum += n;
+			}
 
-			// but the two new points are at the locations where the 
-			// original sides of the triangle (lines) intersect with the plane
-			out_tri1.vertices[1] = Vector_IntersectPlane(plane_p, plane_n, *inside_points[0], *outside_points[0]);
-			out_tri1.vertices[2] = Vector_IntersectPlane(plane_p, plane_n, *inside_points[0], *outside_points[1]);
+			for (size_t i = 0; i < count; ++i)
+				dst[offsets[(src[i].key >> shift) & 0xFF]++] = src[i];
 
-			return 1; // return the newly formed single triangle
+			std::swap(src, dst);
 		}
 
-		if (nInsidePointCount == 2 && nOutsidePointCount == 1)
-		{
-			// triangle should be clipped. As two points lie inside the plane,
-			// the clipped triangle becomes a "quad". Fortunately, we can
-			// represent a quad with two new triangles
+		if (src != keys.data())
+			keys.swap(scratch);
+	}
+
+	Plane Plane_Make(Vector3 point, Vector3 normal) const
+	{
+		normal = Vector3_Normalize(normal);
+		return { normal, Vector3_DotProduct(normal, point) };
+	}
 
-			// copy appearance info to new triangles
-			out_tri1.color = in_tri.color;
-			out_tri1.symbol = in_tri.symbol;
+	// signed shortest distance from point to plane, positive lies on the "inside"
+	float Plane_Distance(const Plane& plane, const Vector3& p) const
+	{
+		return plane.normal.x * p.x + plane.normal.y * p.y + plane.normal.z * p.z - plane.d;
+	}
 
-			out_tri2.color = in_tri.color;
-			out_tri2.symbol = in_tri.symbol;
+	// Sutherland-Hodgman, walk the edges and keep whatever is on the inside
+	// plus the points where an edge crosses the plane
+	void Polygon_ClipAgainstPlane(const Plane& plane, const ClipPolygon& in, ClipPolygon& out) const
+	{
+		out.count = 0;
+		if (in.count == 0)
+			return;
 
-			// the first triangle consists of the two inside points and a new
-			// point determined by the location where one side of the triangle
-			// intersects with the plane
-			out_tri1.vertices[0] = *inside_points[0];
-			out_tri1.vertices[1] = *inside_points[1];
-			out_tri1.vertices[2] = Vector_IntersectPlane(plane_p, plane_n, *inside_points[0], *outside_points[0]);
+		const Vector3* previous = &in.vertices[in.count - 1];
+		float previousDist = Plane_Distance(plane, *previous);
 
-			// the second triangle is composed of one of he inside points, a
-			// new point determined by the intersection of the other side of the 
-			// triangle and the plane, and the newly created point above
-			out_tri2.vertices[0] = *inside_points[1];
-			out_tri2.vertices[1] = out_tri1.vertices[2];
-			out_tri2.vertices[2] = Vector_IntersectPlane(plane_p, plane_n, *inside_points[1], *outside_points[0]);
+		for (int i = 0; i < in.count; ++i)
+		{
+			const Vector3& current = in.vertices[i];
+			float currentDist = Plane_Distance(plane, current);
+
+			if ((previousDist >= 0.0f) != (currentDist >= 0.0f))
+			{
+				float t = previousDist / (previousDist - currentDist);
+				float from = in.luminance[previous - in.vertices];
+				out.luminance[out.count] = from + (in.luminance[i] - from) * t;
+				out.vertices[out.count++] = Vector3_Lerp(*previous, current, t);
+			}
+
+			if (currentDist >= 0.0f)
+			{
+				out.luminance[out.count] = in.luminance[i];
+				out.vertices[out.count++] = current;
+			}
 
-			return 2; // return two newly formed triangles which form a quad
+			previous = &current;
+			previousDist = currentDist;
 		}
 	}
 
@@ -4,12 +4,55 @@
 #include "Space.h"
 #include "World.h"
 
-int main()
+int main(int argc, char** argv)
 {
+	// Console69 spacebench [rocks] [bullets] [frames] [draw 0/1] [seed] [particles]
+	if (argc > 1 && strcmp(argv[1], "spacebench") == 0)
+	{
+		Space::BenchmarkSettings settings;
+		if (argc > 2) settings.rocks = atoi(argv[2]);
+		if (argc > 3) settings.bullets = atoi(argv[3]);
+		if (argc > 4) settings.frames = atoi(argv[4]);
+		if (argc > 5) settings.render = atoi(argv[5]) != 0;
+		if (argc > 6) settings.seed = (unsigned)atoi(argv[6]);
+		if (argc > 7) settings.particles = atoi(argv[7]);
+
+		Space bench;
+		bench.RunBenchmark(settings);
+		return 0;
+	}
+
+	// Console69 mazebench [width] [height] [seed]
+	if (argc > 1 && strcmp(argv[1], "mazebench") == 0)
+	{
+		int width = argc > 2 ? atoi(argv[2]) : 4096;
+		int height = argc > 3 ? atoi(argv[3]) : 4096;
+		unsigned seed = argc > 4 ? (unsigned)atoi(argv[4]) : 69;
+		Maze::RunBenchmark(width, height, seed);
+		return 0;
+	}
+
+	// Console69 mazefile [file] [width] [height] [bands] [seed] [verify 0/1]
+	if (argc > 1 && strcmp(argv[1], "mazefile") == 0)
+	{
+		std::string file = argc > 2 ? argv[2] : "maze.bin";
+		int width = argc > 3 ? atoi(argv[3]) : 16384;
+		int height = argc > 4 ? atoi(argv[4]) : 16384;
+		int bands = argc > 5 ? atoi(argv[5]) : (int)std::thread::hardware_concurrency();
+		unsigned seed = argc > 6 ? (unsigned)atoi(argv[6]) : 69;
+		bool verify = argc > 7 && atoi(argv[7]) != 0;
+		Maze::RunFileBenchmark(file, width, height, bands, seed, verify);
+		return 0;
+	}
+
 	//Maze demo;
 	//Space demo;
 	World demo;
 
+	// Console69 props [count], the terrain with that many instanced crates
+	if (argc > 2 && strcmp(argv[1], "props") == 0)
+		demo.SetPropCount(atoi(argv[2]));
+
 
 
 